@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Throughput benchmark against the simulated board. Runs read, blank check,
+# write and write with verification of 64K-16M images and reports port
+# operations per byte, simulated time per kB and wall time.
+#
+# usage: bench.sh [WILLEM3] [SIM_OPTIONS]
+#
+# SIM_OPTIONS are appended to every simulated port, e.g. "cost=2000" to model
+# a slower parallel port.
+
+WILLEM3=${1:-./willem3}
+EXTRA=${2:+,$2}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+image()
+{
+    head -c "$1" /dev/urandom > "$TMP/$1.bin"
+    echo "$TMP/$1.bin"
+}
+
+# run LABEL BYTES CHIP WILLEM3_OPTIONS...
+run()
+{
+    label=$1
+    bytes=$2
+    chip=$3
+    shift 3
+
+    start=$(date +%s.%N)
+    "$WILLEM3" -p "sim:chip=$chip$EXTRA" "$@" > "$TMP/out" 2> "$TMP/err"
+    status=$?
+    end=$(date +%s.%N)
+
+    awk -v label="$label" -v bytes="$bytes" -v start="$start" -v end="$end" -v status="$status" '
+        /^sim:/ {
+            for (i = 1; i <= NF; i++)
+            {
+                if ($(i + 1) == "ops") ops = $i
+                if ($(i + 1) == "violations,") violations = $i
+                if ($(i + 1) == "s" && $(i + 2) == "simulated") sim = $i
+            }
+        }
+        END {
+            result = (status == 0) ? "ok" : "FAILED"
+            if (violations > 0) result = result " (" violations " violations)"
+            printf "%-26s %9d %10.1f %12.1f %9.2f  %s\n", label, bytes, ops / bytes, sim * 1000000 / (bytes / 1024), end - start, result
+        }' "$TMP/err"
+}
+
+printf "%-26s %9s %10s %12s %9s  %s\n" "test" "bytes" "ops/byte" "sim us/kB" "wall s" "result"
+
+for size in 65536 524288 16777216; do
+    run "read 27C080" $size 27C080,size=$size -E -r "$TMP/dump" -s $size
+done
+
+for size in 65536 524288 16777216; do
+    run "blank check 27C080" $size 27C080,size=$size -E -b -s $size
+done
+
+run "read Am29F040" 524288 Am29F040 -F -r "$TMP/dump"
+run "blank check Am29F040" 524288 Am29F040 -F -b
+
+img=$(image 65536)
+run "write 27C512" 65536 27C512 -E -w "$img"
+run "write+verify 27C512" 65536 27C512 -E -w "$img" -v
+
+img=$(image 131072)
+run "write AT29C010" 131072 AT29C010 -F -w "$img"
+run "write+verify AT29C010" 131072 AT29C010 -F -w "$img" -v
+
+img=$(image 262144)
+run "write W49F002A" 262144 W49F002A -F -w "$img"
+run "write+verify W49F002A" 262144 W49F002A -F -w "$img" -v
+
+img=$(image 524288)
+run "write Am29F040" 524288 Am29F040 -F -w "$img"
+run "write+verify Am29F040" 524288 Am29F040 -F -w "$img" -v
+run "write Am29LV040B" 524288 Am29LV040B -F -w "$img"
+
+img=$(image 16777216)
+run "write+verify 27C080 16M" 16777216 27C080,size=16M -E -w "$img" -v
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bus.h"
+#include "pp_backend.h"
+#include "wave.h"
+#include "delay.h"
+
+#define PULSE_SLACK_PERCENT 25          /* Allowed programming pulse stretch */
+
+/*
+ * Compiles an address shift into w, or leaves it empty if the shift register
+ * already holds the address.
+ */
+static inline void compile_address(bus_t *b, wave_t *w, uint32_t addr)
+{
+    uint32_t value = (addr & b->addr_mask) | b->addr_hold;
+
+    if (b->addr_latched && value == b->addr_latch)
+    {
+        b->addr_shifts_saved++;
+        w->len = 0;
+        return;
+    }
+
+    wave_address(w, value, b->addr_width);
+    b->addr_latch = value;
+    b->addr_latched = true;
+    b->addr_shifts++;
+}
+
+/* Control update without dispatch, counted like the generic one */
+static inline void fast_ucontrol(pp_t *p, unsigned char mask, unsigned char val, int (*wcontrol)(pp_t *, unsigned char))
+{
+    unsigned char control = (p->control & ~mask) | (val & mask);
+
+    if (control != p->control)
+    {
+        p->control = control;
+        p->ops++;
+        wcontrol(p, control);
+    }
+}
+
+/* Raw I/O port access */
+#define BUS_FN(name) direct_##name
+#define BUS_WDATA(p, val) ((p)->ops++, pp_direct_wdata(p, val))
+#define BUS_UCONTROL(p, mask, val) fast_ucontrol(p, mask, val, pp_direct_wcontrol)
+#define BUS_ACK(p) ((p)->ops++, (pp_direct_rstatus(p) & PARPORT_STATUS_ACK) != 0)
+#define BUS_NDELAY(p, nsec) delay_ns(&(p)->delays, nsec)
+#define BUS_TIME(p) delay_now()
+#include "bus_impl.h"
+#undef BUS_FN
+#undef BUS_WDATA
+#undef BUS_UCONTROL
+#undef BUS_ACK
+#undef BUS_NDELAY
+#undef BUS_TIME
+
+/* ppdev ioctls */
+#define BUS_FN(name) parport_##name
+#define BUS_WDATA(p, val) ((p)->ops++, pp_parport_wdata(p, val))
+#define BUS_UCONTROL(p, mask, val) fast_ucontrol(p, mask, val, pp_parport_wcontrol)
+#define BUS_ACK(p) ((p)->ops++, (pp_parport_rstatus(p) & PARPORT_STATUS_ACK) != 0)
+#define BUS_NDELAY(p, nsec) delay_ns(&(p)->delays, nsec)
+#define BUS_TIME(p) delay_now()
+#include "bus_impl.h"
+#undef BUS_FN
+#undef BUS_WDATA
+#undef BUS_UCONTROL
+#undef BUS_ACK
+#undef BUS_NDELAY
+#undef BUS_TIME
+
+/* Any backend through pp.h, also used for the simulator and paranoid mode */
+#define BUS_FN(name) generic_##name
+#define BUS_WDATA(p, val) pp_wdata(p, val)
+#define BUS_UCONTROL(p, mask, val) pp_ucontrol(p, mask, val)
+#define BUS_ACK(p) ((pp_rstatus(p) & PARPORT_STATUS_ACK) != 0)
+#define BUS_NDELAY(p, nsec) pp_ndelay(p, nsec)
+#define BUS_TIME(p) pp_time(p)
+#include "bus_impl.h"
+#undef BUS_FN
+#undef BUS_WDATA
+#undef BUS_UCONTROL
+#undef BUS_ACK
+#undef BUS_NDELAY
+#undef BUS_TIME
+
+static const struct bus_ops bus_ops_direct =
+{
+    "direct", direct_write_address, direct_write_data_w_delay, direct_read_data
+};
+
+static const struct bus_ops bus_ops_parport =
+{
+    "parport", parport_write_address, parport_write_data_w_delay, parport_read_data
+};
+
+static const struct bus_ops bus_ops_generic =
+{
+    "generic", generic_write_address, generic_write_data_w_delay, generic_read_data
+};
+
+/*
+ * Picks the access paths for the opened port once. Paranoid mode needs the
+ * control register read back and a trace needs every access recorded, which
+ * only the generic paths do.
+ */
+void bus_init(bus_t *b, pp_t *pp, struct rt_stats *rt)
+{
+    b->pp = pp;
+    b->rt = rt;
+    b->addr_shifts = 0;
+    b->addr_shifts_saved = 0;
+    b->timing = (struct bus_timing) { BUS_SETUP_NSEC, 0, 0 };
+
+    if (pp->type == PP_DIRECT && !pp->paranoid && pp->trace == NULL)
+    {
+        b->ops = &bus_ops_direct;
+    }
+    else if (pp->type == PP_PARPORT && !pp->paranoid && pp->trace == NULL)
+    {
+        b->ops = &bus_ops_parport;
+    }
+    else
+    {
+        b->ops = &bus_ops_generic;
+    }
+
+    bus_set_address_width(b, 24, 0, 0);
+}
+
+/*
+ * Limits address shifts to the lines the chip uses. A shift of fewer than
+ * all 24 bits moves the previous contents of the register up, so the lines
+ * above carry bits of earlier addresses and change from one address to the
+ * next. That only suits lines the layout leaves unconnected; lines wired to
+ * control pins go in hold_mask, which extends the shift to cover them and
+ * keeps them at hold_value.
+ */
+void bus_set_address_width(bus_t *b, int addr_bits, uint32_t hold_mask, uint32_t hold_value)
+{
+    b->addr_mask = (1 << addr_bits) - 1;
+    b->addr_width = addr_bits;
+    b->addr_hold = 0;
+    b->addr_latched = false;
+
+    hold_mask &= ~b->addr_mask;
+    b->addr_hold = hold_value & hold_mask;
+
+    while (b->addr_width < 24 && (hold_mask >> b->addr_width) != 0)
+    {
+        b->addr_width++;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pp.h"
+#include "rt.h"
+
+typedef struct bus bus_t;
+
+#define BUS_SETUP_NSEC 500              /* Default data setup before write pulse */
+
+/* Delays of the chip access paths, see --calibrate */
+struct bus_timing
+{
+    unsigned int setup_ns;              /* Data setup before and after the write strobe */
+    unsigned int settle_ns;             /* Address and output enable settling before a read */
+    unsigned int clock_ns;              /* Pause after every data register write of a shift or readback */
+};
+
+/* Chip access paths, specialised for the port backend */
+struct bus_ops
+{
+    const char *name;
+    void (*write_address)(bus_t *b, uint32_t addr);
+    void (*write_data_w_delay)(bus_t *b, uint32_t addr, uint8_t value, unsigned int usec);
+    uint8_t (*read_data)(bus_t *b, uint32_t addr, bool pulse_s4);
+};
+
+struct bus
+{
+    pp_t *pp;
+    const struct bus_ops *ops;
+    struct bus_timing timing;
+
+    /* Address shift register usage, all 24 bits until the chip is known */
+    int addr_width;
+    uint32_t addr_mask;
+    uint32_t addr_hold;
+
+    /* Value currently held by the address shift register */
+    uint32_t addr_latch;
+    bool addr_latched;
+
+    unsigned long addr_shifts;
+    unsigned long addr_shifts_saved;
+
+    /* Programming pulses are accounted here */
+    struct rt_stats *rt;
+};
+
+void bus_init(bus_t *b, pp_t *pp, struct rt_stats *rt);
+void bus_set_address_width(bus_t *b, int addr_bits, uint32_t hold_mask, uint32_t hold_value);
+
+static inline void bus_write_address(bus_t *b, uint32_t addr)
+{
+    b->ops->write_address(b, addr);
+}
+
+static inline void bus_write_data_w_delay(bus_t *b, uint32_t addr, uint8_t value, unsigned int usec)
+{
+    b->ops->write_data_w_delay(b, addr, value, usec);
+}
+
+static inline uint8_t bus_read_data(bus_t *b, uint32_t addr, bool pulse_s4)
+{
+    return b->ops->read_data(b, addr, pulse_s4);
+}
+
+#endif /* BUS_H */
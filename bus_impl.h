@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Chip access paths, included by bus.c once per port backend. The includer
+ * defines:
+ *
+ * BUS_FN(name)                 - name of an instantiated function
+ * BUS_WDATA(p, val)            - write data register
+ * BUS_UCONTROL(p, mask, val)   - update control register bits
+ * BUS_ACK(p)                   - read ACK as 0 or 1
+ * BUS_NDELAY(p, nsec)          - delay
+ * BUS_TIME(p)                  - current time in nanoseconds
+ *
+ * so the per-bit loops have no backend dispatch and no calls left in them.
+ */
+
+static inline void BUS_FN(set_s4)(pp_t *p, bool value)
+{
+    BUS_UCONTROL(p, PARPORT_CONTROL_SELECT, value ? PARPORT_CONTROL_SELECT : 0);
+}
+
+static inline void BUS_FN(set_s6)(pp_t *p, bool value)
+{
+    BUS_UCONTROL(p, PARPORT_CONTROL_AUTOFD, value ? 0 : PARPORT_CONTROL_AUTOFD);
+}
+
+static inline void BUS_FN(wdata)(pp_t *p, unsigned char val)
+{
+    p->data = val;
+    BUS_WDATA(p, val);
+}
+
+/* Plays a wave, pausing pace_ns after every write if the board needs it */
+static inline int BUS_FN(play)(pp_t *p, const uint16_t *ops, unsigned int len, unsigned int pace_ns)
+{
+    int res = 0;
+
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (ops[i] & PP_OP_SAMPLE)
+        {
+            res = (res << 1) | BUS_ACK(p);
+        }
+        else
+        {
+            BUS_FN(wdata)(p, ops[i]);
+
+            if (pace_ns)
+            {
+                BUS_NDELAY(p, pace_ns);
+            }
+        }
+    }
+
+    return res;
+}
+
+/*
+ * Plays an access with S6 low. The first write lowers the clock before S6
+ * lets it through to the shift register.
+ */
+static inline int BUS_FN(play_access)(pp_t *p, const wave_t *w, unsigned int pace_ns)
+{
+    if (w->len == 0)
+    {
+        if (p->data & 1)
+        {
+            BUS_FN(wdata)(p, p->data & ~1);
+        }
+        BUS_FN(set_s6)(p, false);
+        return 0;
+    }
+
+    BUS_FN(wdata)(p, w->ops[0]);
+    BUS_FN(set_s6)(p, false);
+
+    if (pace_ns)
+    {
+        BUS_NDELAY(p, pace_ns);
+    }
+
+    return BUS_FN(play)(p, w->ops + 1, w->len - 1, pace_ns);
+}
+
+static void BUS_FN(write_address)(bus_t *b, uint32_t addr)
+{
+    wave_t w;
+
+    compile_address(b, &w, addr);
+
+    if (w.len > 0)
+    {
+        BUS_FN(play_access)(b->pp, &w, b->timing.clock_ns);
+    }
+}
+
+static void BUS_FN(write_data_w_delay)(bus_t *b, uint32_t addr, uint8_t value, unsigned int usec)
+{
+    pp_t *p = b->pp;
+    unsigned int setup_ns = b->timing.setup_ns;
+
+    BUS_FN(write_address)(b, addr);
+    BUS_FN(set_s6)(p, true);
+
+    if (setup_ns)
+    {
+        BUS_NDELAY(p, setup_ns);
+    }
+
+    BUS_FN(wdata)(p, value);
+
+    if (setup_ns)
+    {
+        BUS_NDELAY(p, setup_ns);
+    }
+
+    BUS_FN(set_s4)(p, false);
+    if (usec)
+    {
+        uint64_t start = BUS_TIME(p);
+
+        BUS_NDELAY(p, usec * 1000ULL);
+        BUS_FN(set_s4)(p, true);
+
+        rt_account(b->rt, BUS_TIME(p) - start, usec * (100ULL + PULSE_SLACK_PERCENT) * 10);
+    }
+    else
+    {
+        BUS_FN(set_s4)(p, true);
+    }
+}
+
+static uint8_t BUS_FN(read_data)(bus_t *b, uint32_t addr, bool pulse_s4)
+{
+    pp_t *p = b->pp;
+    unsigned int pace_ns = b->timing.clock_ns;
+    wave_t w;
+    int res;
+
+    compile_address(b, &w, addr);
+
+    /* Address and readout in one go unless the outputs need time to settle */
+    if (!pulse_s4 && b->timing.settle_ns == 0)
+    {
+        wave_read(&w);
+        res = BUS_FN(play_access)(p, &w, pace_ns);
+    }
+    else
+    {
+        BUS_FN(play_access)(p, &w, pace_ns);
+
+        if (pulse_s4)
+        {
+            BUS_FN(set_s4)(p, false);
+        }
+
+        if (b->timing.settle_ns)
+        {
+            BUS_NDELAY(p, b->timing.settle_ns);
+        }
+
+        w.len = 0;
+        wave_read(&w);
+        res = BUS_FN(play)(p, w.ops, w.len, pace_ns);
+
+        if (pulse_s4)
+        {
+            BUS_FN(set_s4)(p, true);
+        }
+    }
+
+    /* ACK is the inverted output of the readback register */
+    return ~res;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Delays with sub-microsecond resolution. Short delays busy-wait on the
+ * monotonic clock, long ones sleep until shortly before an absolute deadline
+ * and busy-wait the rest. delay_init() measures the cost of reading the
+ * clock and how late the kernel wakes us up, so that both can be
+ * compensated for.
+ */
+
+#include "delay.h"
+
+#include <time.h>
+#include <errno.h>
+
+#define SPIN_MIN_NS 100000              /* Always busy-wait below this */
+#define CALIBRATE_ROUNDS 16
+
+static uint64_t clock_cost_ns = 0;      /* Cost of reading the clock */
+static uint64_t wakeup_slack_ns = 50000;    /* How late sleeps wake up */
+
+uint64_t delay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+void delay_init(void)
+{
+    uint64_t start = delay_now();
+    uint64_t end = start;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        end = delay_now();
+    }
+
+    clock_cost_ns = (end - start) / 1000;
+
+    /* Use the worst wakeup latency seen */
+    uint64_t slack = 0;
+
+    for (int i = 0; i < CALIBRATE_ROUNDS; ++i)
+    {
+        uint64_t deadline = delay_now() + SPIN_MIN_NS / 2;
+
+        sleep_until(deadline);
+
+        uint64_t late = delay_now() - deadline;
+
+        if (late > slack)
+        {
+            slack = late;
+        }
+    }
+
+    wakeup_slack_ns = slack;
+}
+
+void delay_ns(struct delay_stats *st, uint64_t ns)
+{
+    uint64_t start = delay_now();
+    uint64_t deadline = start + ns;
+    uint64_t now;
+
+    if (ns > SPIN_MIN_NS && ns > 2 * wakeup_slack_ns)
+    {
+        sleep_until(deadline - wakeup_slack_ns);
+    }
+
+    while ((now = delay_now()) + clock_cost_ns < deadline)
+    {
+    }
+
+    if (st != NULL)
+    {
+        st->count++;
+        st->requested_ns += ns;
+        st->actual_ns += now - start;
+
+        if (now - start > ns && now - start - ns > st->max_over_ns)
+        {
+            st->max_over_ns = now - start - ns;
+        }
+    }
+}
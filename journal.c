@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Write journal. The first line identifies the write (image checksum and
+ * length, chip and offset), each following line holds the number of image
+ * bytes known to be written. An interrupted write can continue after the
+ * last complete line if the identification matches. Reads keep the same
+ * kind of journal, counting the bytes passed to the output file.
+ */
+
+#include "journal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "willem3-journal"
+#define JOURNAL_SYNC_BYTES (64 * 1024)  /* Progress between syncs to disk */
+
+/* Returns the last recorded count if the journal belongs to the same write */
+static uint32_t journal_scan(FILE *f, const char *key)
+{
+    char line[256];
+    unsigned long done = 0;
+
+    if (fgets(line, sizeof(line), f) == NULL || strncmp(line, JOURNAL_MAGIC " ", strlen(JOURNAL_MAGIC) + 1) != 0)
+    {
+        return 0;
+    }
+
+    line[strcspn(line, "\n")] = 0;
+
+    if (strcmp(line + strlen(JOURNAL_MAGIC) + 1, key) != 0)
+    {
+        return 0;
+    }
+
+    /* A line cut short by a crash has no newline and is ignored */
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char *endptr = NULL;
+        unsigned long tmp = strtoul(line, &endptr, 10);
+
+        if (*endptr == '\n' && tmp <= UINT32_MAX)
+        {
+            done = tmp;
+        }
+    }
+
+    return (uint32_t) done;
+}
+
+/*
+ * Starts recording the write identified by key. With resume, done is set to
+ * the bytes recorded by an earlier run of the same write, otherwise to 0.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int journal_open(struct journal *j, const char *path, const char *key, bool resume, uint32_t *done)
+{
+    *done = 0;
+    j->f = NULL;
+    j->path = strdup(path);
+
+    if (j->path == NULL)
+    {
+        return -1;
+    }
+
+    if (resume)
+    {
+        FILE *f = fopen(path, "r");
+
+        if (f != NULL)
+        {
+            *done = journal_scan(f, key);
+            fclose(f);
+        }
+    }
+
+    j->f = fopen(path, "w");
+
+    if (j->f == NULL)
+    {
+        int saved_errno = errno;
+
+        free(j->path);
+        j->path = NULL;
+        errno = saved_errno;
+
+        return -1;
+    }
+
+    fprintf(j->f, JOURNAL_MAGIC " %s\n", key);
+
+    if (*done > 0)
+    {
+        fprintf(j->f, "%u\n", *done);
+    }
+
+    fflush(j->f);
+    fsync(fileno(j->f));
+    j->synced = *done;
+
+    return 0;
+}
+
+/*
+ * Records that the first done bytes of the image are written. Called from
+ * the thread driving the board once per written block, so records only go
+ * to the page cache, which survives a crash of the program. They are synced
+ * to disk every JOURNAL_SYNC_BYTES only; after a power loss the write
+ * resumes from the last synced count, the block after it is read back and
+ * the rest programmed again (with -v verified again), which only costs time.
+ */
+void journal_record(struct journal *j, uint32_t done)
+{
+    if (j->f == NULL)
+    {
+        return;
+    }
+
+    fprintf(j->f, "%u\n", done);
+    fflush(j->f);
+
+    if (done - j->synced >= JOURNAL_SYNC_BYTES)
+    {
+        fsync(fileno(j->f));
+        j->synced = done;
+    }
+}
+
+/* Closes the journal, which is no longer needed once the write completed */
+void journal_close(struct journal *j, bool complete)
+{
+    if (j->f == NULL)
+    {
+        return;
+    }
+
+    fclose(j->f);
+    j->f = NULL;
+
+    if (complete)
+    {
+        unlink(j->path);
+    }
+
+    free(j->path);
+    j->path = NULL;
+}
@@ -30,7 +30,13 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "pp.h"
+#include "willem.h"
+#include "delay.h"
+#include "writer.h"
+#include "journal.h"
+#include "report.h"
+#include "profile.h"
+#include "crc32.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -39,215 +45,779 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <getopt.h>
 #include <sched.h>
 #include <limits.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define DEFAULT_PORT "/dev/parport0"
 
-struct chip_config
+#define LATENCY_TEST_MSEC 200           /* Duration of the startup latency self-test */
+#define MAX_PORTS 16                    /* Boards programmed at once */
+#define GANG_PROGRESS_MSEC 250          /* Progress update interval with several boards */
+#define DAEMON_BACKLOG 16               /* Clients waiting for the daemon */
+#define DAEMON_LINE_MAX 4096            /* Longest daemon protocol line */
+#define READ_CHUNK_SIZE (64 * 1024)     /* Read data written to the file at once */
+#define READ_CHUNKS 4                   /* Read chunks held in memory */
+#define PROFILE_FILE ".willem3-profiles" /* Calibrated timing in the home directory */
+
+/* Board driven by this program and the state of its output */
+struct board
 {
-    uint16_t id;                        /* Chip id (manufacturer and device) */
-    uint32_t size;                      /* Size in bytes */
-    uint32_t sector_size;               /* Sector size or 0 if byte-programmed */
-    const char *name;                   /* Chip name */
-    unsigned int max_write_usec;        /* Maximum sector/byte write time in microseconds */
-    unsigned int max_chip_erase_sec;    /* Maximum chip erase time in seconds */
-};
+    struct willem_session s;
 
-#define K(x) ((x) * 1024)
-struct chip_config chip_config[] =
-{
-    { 0xda08, K(64),  0, "W27C512", -1, -1 },
+    /* Several boards run at once, progress is reported by the main thread */
+    bool gang;
+    bool progress_line;
+
+    /* Connection of the daemon client whose job is running */
+    FILE *client;
+
+    /* File being read to and the chip address of its first byte */
+    int read_fd;
+    struct writer *writer;
+    uint32_t read_base;
 
-    { 0xda0b, K(256), 0, "W49F002A", 50, 1 },
+    /* Progress of the write, so that an interrupted one can be resumed */
+    struct journal journal;
 
-    { 0x01a4, K(512), 0, "Am29F040", 7, 64 },
+    /* Port operation trace file */
+    char trace[PATH_MAX];
 
-    { 0x1f5d, K(32), 128, "AT29C512", 10000, 20 },
-    { 0x1fd5, K(128), 128, "AT29C010", 10000, 20 },
-    { 0x1fda, K(256), 256, "AT29C020", 10000, 20 },
-    { 0x1f5b, K(512), 512, "AT29C040", 10000, 20 },
-    { 0x1fa4, K(512), 256, "AT29C040A", 10000, 20 },
-    { 0x1f3b, K(512), 512, "AT29LV040", 10000, 20 },
-    { 0x1fc4, K(512), 256, "AT29LV040A", 10000, 20 }
+    /* Calibrated timing, the port-wide one applies until the chip is known */
+    const struct profiles *profiles;
+    struct bus_timing port_timing;
+
+    /* Worker thread in gang mode */
+    const struct rt_config *rc;
+    pthread_t thread;
+    int cpu;
+    int result;
+    volatile bool done;
 };
-#undef K
 
-pp_t pp;
+/*
+ * Progress of the current phase. A single board prints it right away, with
+ * several boards the main thread prints all of them together. Daemon
+ * clients get it as a protocol line.
+ */
+int board_progress(void *arg, const char *phase, long kb)
+{
+    struct board *b = arg;
 
-void set_vcc(bool value)
+    if (b->client != NULL)
+    {
+        if (kb < 0)
+        {
+            fprintf(b->client, "progress %s\n", phase);
+        }
+        else
+        {
+            fprintf(b->client, "progress %s %ld\n", phase, kb);
+        }
+        fflush(b->client);
+    }
+    else if (!b->gang)
+    {
+        if (kb < 0)
+        {
+            printf("%s...", phase);
+        }
+        else
+        {
+            printf("\r%s %ld kB...", phase, kb);
+        }
+        fflush(stdout);
+        b->progress_line = true;
+    }
+
+    return 0;
+}
+
+void board_message(void *arg, const char *text)
 {
-    if (value)
+    struct board *b = arg;
+
+    if (b->client != NULL)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) | PARPORT_CONTROL_INIT);
+        fprintf(b->client, "info %s", text);
     }
-    else
+    else if (!b->gang)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) & ~PARPORT_CONTROL_INIT);
+        if (b->progress_line)
+        {
+            printf("\n");
+            b->progress_line = false;
+        }
+
+        fputs(text, stdout);
     }
 }
 
-void set_vpp(bool value)
+/* Gang and daemon mode report the error kept in the session at the end */
+void board_error(void *arg, const char *text)
 {
-    if (value)
+    struct board *b = arg;
+
+    if (b->gang || b->client != NULL)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) | PARPORT_CONTROL_STROBE);
+        return;
     }
-    else
+
+    if (b->progress_line)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) & ~PARPORT_CONTROL_STROBE);
+        printf("\n");
+        fflush(stdout);
+        b->progress_line = false;
     }
+
+    fputs(text, stderr);
 }
 
-void set_s4(bool value)
+int board_read_chunk(void *arg, uint32_t addr, const uint8_t *data, size_t len)
 {
-    if (value)
+    struct board *b = arg;
+
+    if (writer_write(b->writer, addr - b->read_base, data, len) == -1)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) | PARPORT_CONTROL_SELECT);
+        return -1;
+    }
+
+    journal_record(&b->journal, addr - b->read_base + len);
+
+    return 0;
+}
+
+void board_written(void *arg, uint32_t done)
+{
+    struct board *b = arg;
+
+    journal_record(&b->journal, done);
+}
+
+/* Profile key of the chip in the session */
+void board_chip_key(struct willem_session *s, char *key, size_t size)
+{
+    if (s->chip_id != 0)
+    {
+        snprintf(key, size, "0x%04x", s->chip_id);
     }
     else
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) & ~PARPORT_CONTROL_SELECT);
+        snprintf(key, size, "%s", (s->cc != NULL) ? s->cc->name : "EPROM");
     }
 }
 
-void set_s6(bool value)
+/* Switches to the timing calibrated for the chip, or back to the port-wide one */
+void board_identified(void *arg)
 {
-    if (value)
+    struct board *b = arg;
+    struct willem_session *s = &b->s;
+    struct bus_timing t;
+    char key[32];
+
+    if (b->profiles == NULL)
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) & ~PARPORT_CONTROL_AUTOFD);
+        return;
     }
-    else
+
+    board_chip_key(s, key, sizeof(key));
+
+    if (!profiles_find(b->profiles, s->port, key, &t))
     {
-        pp_wcontrol(&pp, pp_rcontrol(&pp) | PARPORT_CONTROL_AUTOFD);
+        s->bus.timing = b->port_timing;
+        return;
+    }
+
+    s->bus.timing = t;
+
+    if (s->cb.message != NULL)
+    {
+        char text[128];
+
+        snprintf(text, sizeof(text), "Calibrated timing: setup %u ns, settle %u ns, clock %u ns\n", t.setup_ns, t.settle_ns, t.clock_ns);
+        s->cb.message(s->cb.arg, text);
     }
 }
 
-void write_address(uint32_t value)
+/*
+ * Opens the file a read from base goes to. With a key (chip, offset and size
+ * of the read) the progress is kept in FILE.journal, and with resume a read
+ * of the same key continues after the last chunk both the journal and the
+ * file hold, anything after it is discarded. A file longer than size (if
+ * known) is refused. Returns the number of bytes kept or -1 on failure with
+ * errno set.
+ */
+off_t board_read_open(struct board *b, const char *path, uint32_t base, uint32_t size, const char *key, bool resume)
 {
-    pp_wdata(&pp, 0);
-    set_s6(false);
-    int i;
-    const int addr_size = 24;
-    for (i = 0; i < addr_size; ++i)
-    {
-        value <<= 1;
-        uint8_t data = (value & (1 << addr_size)) ? 2 : 0;    // D
-        pp_wdata(&pp, data);
-        pp_wdata(&pp, data | 1);    // CLK
-        pp_wdata(&pp, data);
+    int fd = open(path, O_CREAT | O_WRONLY | (resume ? 0 : O_TRUNC), 0644);
+    off_t done = 0;
+
+    if (fd == -1)
+    {
+        return -1;
     }
+
+    if (resume)
+    {
+        done = lseek(fd, 0, SEEK_END);
+
+        if (size != 0 && done > size)
+        {
+            close(fd);
+            errno = EFBIG;
+
+            return -1;
+        }
+    }
+
+    if (key != NULL && done != -1)
+    {
+        char journal[PATH_MAX];
+        uint32_t recorded = 0;
+
+        snprintf(journal, sizeof(journal), "%s.journal", path);
+
+        if (journal_open(&b->journal, journal, key, resume, &recorded) == -1)
+        {
+            fprintf(stderr, "%s: %s, continuing without journal\n", journal, strerror(errno));
+        }
+
+        /* The file may hold more than recorded or the other way round */
+        if (done > recorded)
+        {
+            done = recorded;
+        }
+
+        done -= done % READ_CHUNK_SIZE;
+    }
+
+    if (resume && done != -1 && ftruncate(fd, done) == -1)
+    {
+        done = -1;
+    }
+
+    b->writer = (done != -1) ? writer_open(fd, READ_CHUNK_SIZE, READ_CHUNKS) : NULL;
+
+    if (b->writer == NULL)
+    {
+        int saved_errno = errno;
+
+        journal_close(&b->journal, false);
+        close(fd);
+        errno = saved_errno;
+
+        return -1;
+    }
+
+    b->read_fd = fd;
+    b->read_base = base;
+
+    return done;
 }
 
-void write_data_w_delay(uint32_t addr, uint8_t value, unsigned int usec)
+/*
+ * Returns 0 if all data read has been written, -1 with errno set otherwise.
+ * The journal is removed if the read is complete.
+ */
+int board_read_close(struct board *b, bool complete)
 {
-    write_address(addr);
-    set_s6(true);
+    int res = writer_close(b->writer);
 
-    usleep(2);
-    pp_wdata(&pp, value);
-    usleep(2);
-    set_s4(false);
-    if (usec)
+    if (close(b->read_fd) == -1)
     {
-        usleep(usec);
+        res = -1;
     }
-    set_s4(true);
+
+    journal_close(&b->journal, complete && res == 0);
+
+    b->writer = NULL;
+    b->read_fd = -1;
+
+    return res;
 }
 
-void write_data(uint32_t addr, uint8_t value)
+void board_init(struct board *b, const char *port, const struct willem_job *job)
 {
-    write_data_w_delay(addr, value, 0);
+    struct willem_callbacks cb = { board_progress, board_message, board_error, board_read_chunk, board_written, board_identified, b };
+
+    memset(b, 0, sizeof(*b));
+    willem_init(&b->s, port, job, &cb);
+    b->read_fd = -1;
 }
 
-uint8_t read_data(uint32_t addr, bool pulse_s4)
+void print_stats(struct willem_session *s)
 {
-    write_address(addr);
-    set_s6(false);
+    printf("Access paths: %s\n", s->bus.ops->name);
+    printf("Address shifts: %lu, skipped: %lu\n", s->bus.addr_shifts, s->bus.addr_shifts_saved);
+    printf("Status polls: %lu\n", s->status_polls);
+    printf("Delays: %lu, requested %.3f ms, actual %.3f ms, worst overshoot %.1f us\n",
+           s->pp.delays.count, s->pp.delays.requested_ns / 1e6, s->pp.delays.actual_ns / 1e6, s->pp.delays.max_over_ns / 1e3);
 
-    if (pulse_s4)
+    if (s->eprom_bytes > 0)
     {
-        set_s4(false);
+        printf("EPROM pulses: %lu for %lu bytes\n", s->eprom_pulses, s->eprom_bytes);
     }
 
-    pp_wdata(&pp, 2 | 4);   // P/S=1, CLK=0
-    pp_wdata(&pp, 2);       // P/S=1, CLK=1
-    pp_wdata(&pp, 4);       // P/S=0, CLK=0
-    int i;
-    uint8_t value = 0;
-    for (i = 0; i < 8; ++i)
+    printf("Critical sections: %lu, overran: %lu, worst overrun %.1f us\n",
+           s->rt_stats.sections, s->rt_stats.overruns, s->rt_stats.worst_over_ns / 1e3);
+
+    printf("%-12s %10s %10s %10s %10s %8s %10s %10s\n", "Phase", "time s", "kB/s", "port ops", "addr shift", "polls", "sleep ms", "slept ms");
+
+    for (int i = 0; i < WILLEM_PHASES; i++)
     {
-        value <<= 1;
-        if (!(pp_rstatus(&pp) & PARPORT_STATUS_ACK))
+        const struct willem_phase_stats *st = &s->phase_stats[i];
+
+        if (st->time_ns == 0 && st->port_ops == 0)
         {
-            value |= 1;
+            continue;
         }
-        pp_wdata(&pp, 0);   // P/S=0, CLK=1
-        pp_wdata(&pp, 4);   // P/S=0, CLK=0
+
+        printf("%-12s %10.3f %10.1f %10lu %10lu %8lu %10.3f %10.3f\n", willem_phase_names[i], st->time_ns / 1e9,
+               (st->time_ns > 0) ? st->bytes / 1024.0 / (st->time_ns / 1e9) : 0.0, st->port_ops, st->addr_shifts,
+               st->status_polls, st->delay_requested_ns / 1e6, st->delay_actual_ns / 1e6);
     }
-    pp_wdata(&pp, 0);
-    if (pulse_s4)
+
+    const struct willem_histogram *h = &s->program_hist;
+
+    if (h->count > 0)
     {
-        set_s4(true);
+        printf("Program time per %u bytes: %lu samples, min %.1f us, mean %.1f us, max %.1f us\n",
+               h->unit, h->count, h->min_ns / 1e3, h->total_ns / 1e3 / h->count, h->max_ns / 1e3);
     }
+}
+
+void print_estimate(struct willem_session *s, const struct willem_estimate *e)
+{
+    struct willem_phase_stats total = { 0 };
 
-    return value;
+    printf("Estimate for %s on %s, port access %.0f ns\n", e->cc->name, s->port, e->op_ns);
+
+    if (s->job->do_write != NULL)
+    {
+        const char *unit = (e->cc->sector_size > 0) ? "pages" : ((e->cc->sectors != NULL && s->job->flash) ? "sectors" : "1 kB blocks");
+
+        printf("Bytes to program: %u, %s holding them: %u\n", e->write_bytes, unit, e->write_units);
+    }
+
+    printf("%-12s %10s %10s %10s %10s %8s %10s\n", "Phase", "time s", "kB", "port ops", "addr shift", "polls", "sleep ms");
+
+    for (int i = 0; i < WILLEM_PHASES; i++)
+    {
+        const struct willem_phase_stats *st = &e->phase[i];
+
+        if (st->time_ns == 0 && st->port_ops == 0)
+        {
+            continue;
+        }
+
+        printf("%-12s %10.3f %10lu %10lu %10lu %8lu %10.3f\n", willem_phase_names[i], st->time_ns / 1e9,
+               (unsigned long) (st->bytes / 1024), st->port_ops, st->addr_shifts, st->status_polls, st->delay_requested_ns / 1e6);
+
+        total.time_ns += st->time_ns;
+        total.port_ops += st->port_ops;
+    }
+
+    printf("Total %.1f s, %lu port operations\n", total.time_ns / 1e9, total.port_ops);
 }
 
-uint16_t flash_id(void)
+/*
+ * Reads the whole file to memory. Returns the buffer or NULL on failure with
+ * errno set.
+ */
+uint8_t *load_file(const char *path, uint32_t *len)
 {
-    write_data(0x5555, 0xaa);
-    write_data(0x2aaa, 0x55);
-    write_data(0x5555, 0x90);
-    usleep(10000);
+    struct stat st;
+    uint8_t *buf = NULL;
+    size_t pos = 0;
+    int saved_errno;
+    int fd = open(path, O_RDONLY);
 
-    uint16_t id = read_data(0, false) << 8;
-    id |= read_data(1, false);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        goto failure;
+    }
+
+    if (st.st_size > UINT32_MAX)
+    {
+        errno = EFBIG;
+        goto failure;
+    }
+
+    buf = malloc(st.st_size + 1);
+
+    if (buf == NULL)
+    {
+        goto failure;
+    }
+
+    while (pos < st.st_size)
+    {
+        ssize_t res = read(fd, buf + pos, st.st_size - pos);
+
+        if (res <= 0)
+        {
+            if (res == 0)
+            {
+                errno = EIO;
+            }
+            goto failure;
+        }
+
+        pos += res;
+    }
+
+    close(fd);
+    *len = (uint32_t) pos;
+
+    return buf;
+
+failure:
+    saved_errno = errno;
+
+    free(buf);
+    close(fd);
+    errno = saved_errno;
+
+    return NULL;
+}
+
+/* Parses an optional numeric job argument */
+int parse_arg(const char *arg, uint32_t *value)
+{
+    char *endptr = NULL;
+    unsigned long tmp;
+
+    if (arg == NULL)
+    {
+        return 0;
+    }
+
+    errno = 0;
+    tmp = strtoul(arg, &endptr, 0);
+
+    if (tmp > UINT32_MAX || errno != 0 || *endptr != 0 || endptr == arg)
+    {
+        return -1;
+    }
 
-    write_data(0x5555, 0xaa);
-    write_data(0x2aaa, 0x55);
-    write_data(0x5555, 0xf0);
-    usleep(10000);
+    *value = (uint32_t) tmp;
 
-    return id;
+    return 0;
 }
 
-void flash_write(uint32_t addr, const uint8_t *data, size_t len)
+/*
+ * Runs a single daemon job described by a protocol line. Returns 0 on
+ * success, -1 on failure and 1 if the client asked to disconnect.
+ */
+int daemon_job(struct board *b, char *line)
 {
-    write_data(0x5555, 0xaa);
-    write_data(0x2aaa, 0x55);
-    write_data(0x5555, 0xa0);
-    
-    while (len > 0)
+    struct willem_session *s = &b->s;
+    struct willem_job job = *s->job;
+    char *saveptr = NULL;
+    const char *cmd = strtok_r(line, " \t\r\n", &saveptr);
+    const char *arg[3];
+    uint8_t *image = NULL;
+    int res;
+
+    for (int i = 0; i < 3; i++)
+    {
+        arg[i] = strtok_r(NULL, " \t\r\n", &saveptr);
+    }
+
+    s->error[0] = 0;
+
+    if (cmd == NULL)
+    {
+        snprintf(s->error, sizeof(s->error), "Empty command\n");
+        return -1;
+    }
+
+    if (strcmp(cmd, "quit") == 0)
+    {
+        return 1;
+    }
+
+    if (strcmp(cmd, "off") == 0)
+    {
+        if (s->powered)
+        {
+            willem_power_off(s);
+        }
+        return 0;
+    }
+
+    if (strcmp(cmd, "id") == 0 || strcmp(cmd, "erase") == 0)
+    {
+        job.do_erase = (cmd[0] == 'e');
+    }
+    else if (strcmp(cmd, "blank") == 0 || strcmp(cmd, "crc") == 0)
+    {
+        job.do_blank_check = (cmd[0] == 'b');
+        job.do_crc = (cmd[0] == 'c');
+
+        if (parse_arg(arg[0], &job.offset) == -1 || parse_arg(arg[1], &job.size) == -1)
+        {
+            snprintf(s->error, sizeof(s->error), "Invalid offset or size\n");
+            return -1;
+        }
+    }
+    else if (strcmp(cmd, "read") == 0)
+    {
+        job.do_read = true;
+
+        if (arg[0] == NULL || parse_arg(arg[1], &job.offset) == -1 || parse_arg(arg[2], &job.size) == -1)
+        {
+            snprintf(s->error, sizeof(s->error), "Usage: read FILE [OFFSET [SIZE]]\n");
+            return -1;
+        }
+
+        if (board_read_open(b, arg[0], job.offset, job.size, NULL, false) == -1)
+        {
+            snprintf(s->error, sizeof(s->error), "%s: %s\n", arg[0], strerror(errno));
+            return -1;
+        }
+    }
+    else if (strcmp(cmd, "write") == 0 || strcmp(cmd, "verify") == 0)
+    {
+        if (arg[0] == NULL || parse_arg(arg[1], &job.offset) == -1)
+        {
+            snprintf(s->error, sizeof(s->error), "Usage: %s FILE [OFFSET]\n", cmd);
+            return -1;
+        }
+
+        image = load_file(arg[0], &job.image_len);
+
+        if (image == NULL)
+        {
+            snprintf(s->error, sizeof(s->error), "%s: %s\n", arg[0], strerror(errno));
+            return -1;
+        }
+
+        job.image = image;
+        job.do_write = (cmd[0] == 'w') ? arg[0] : NULL;
+    }
+    else
+    {
+        snprintf(s->error, sizeof(s->error), "Unknown command '%s'\n", cmd);
+        return -1;
+    }
+
+    bool identified = !s->powered && job.flash && job.chip == NULL;
+
+    if (!s->powered && willem_power_on(s) == -1)
+    {
+        free(image);
+
+        if (b->writer != NULL)
+        {
+            board_read_close(b, false);
+        }
+        return -1;
+    }
+
+    if (strcmp(cmd, "id") == 0)
+    {
+        /* Otherwise power up has just reported it */
+        if (!identified && s->cc == NULL)
+        {
+            fprintf(b->client, "info Chip unknown\n");
+        }
+        else if (!identified && job.flash && job.chip == NULL)
+        {
+            fprintf(b->client, "info Chip id 0x%04x (%s)\n", s->chip_id, s->cc->name);
+        }
+        else if (!identified)
+        {
+            fprintf(b->client, "info Chip %s\n", s->cc->name);
+        }
+
+        res = 0;
+    }
+    else if (strcmp(cmd, "verify") == 0)
     {
-        write_data(addr, *data);
-        addr++;
-        data++;
-        len--;
+        res = willem_verify(s, job.offset, image, job.image_len);
     }
+    else
+    {
+        res = willem_run_job(s, &job);
+    }
+
+    free(image);
+
+    if (b->writer != NULL && board_read_close(b, res == 0) == -1 && res == 0)
+    {
+        snprintf(s->error, sizeof(s->error), "%s: %s\n", arg[0], strerror(errno));
+        res = -1;
+    }
+
+    /* The chip is identified again by the next job */
+    if (res == -1 && s->powered)
+    {
+        willem_power_off(s);
+    }
+
+    return res;
 }
 
-void flash_erase(void)
+/* Serves jobs of a single client until it disconnects */
+void daemon_client(struct board *b, int fd)
 {
-    write_data(0x5555, 0xaa);
-    write_data(0x2aaa, 0x55);
-    write_data(0x5555, 0x80);
+    struct willem_session *s = &b->s;
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    char line[DAEMON_LINE_MAX];
+
+    if (in == NULL || out == NULL)
+    {
+        perror("fdopen");
+
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        else
+        {
+            close(fd);
+        }
+
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+
+        return;
+    }
+
+    b->client = out;
+
+    while (!s->terminate && fgets(line, sizeof(line), in) != NULL)
+    {
+        int res = daemon_job(b, line);
+
+        if (res == 1)
+        {
+            break;
+        }
 
-    write_data(0x5555, 0xaa);
-    write_data(0x2aaa, 0x55);
-    write_data(0x5555, 0x10);
+        if (res == 0 && s->terminate)
+        {
+            snprintf(s->error, sizeof(s->error), "Interrupted\n");
+            res = -1;
+        }
+
+        if (res == 0)
+        {
+            fprintf(out, "ok\n");
+        }
+        else
+        {
+            fprintf(out, "error %s", (s->error[0] != 0) ? s->error : "Failed\n");
+        }
+
+        fflush(out);
+    }
+
+    b->client = NULL;
+
+    /* Power is kept only while the client stays connected */
+    if (s->powered)
+    {
+        willem_power_off(s);
+    }
+
+    fclose(in);
+    fclose(out);
 }
 
-int set_realtime(void)
+/*
+ * Keeps the port claimed and runs jobs sent over a Unix socket, one client
+ * at a time. Clients waiting to connect are queued by the listen backlog.
+ * Returns 0 when terminated by a signal, -1 on failure.
+ */
+int daemon_run(struct board *b, const char *path)
 {
-	struct sched_param p;
+    struct willem_session *s = &b->s;
+    struct sockaddr_un addr;
+    struct stat st;
+    int sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: Socket path too long\n", path);
+        return -1;
+    }
+
+    /* Remove a socket left by a previous instance */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
 
-	memset(&p, 0, sizeof(p));
-	p.sched_priority = 1;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
 
-	return sched_setscheduler(0, SCHED_RR, &p);
+    if (sock == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sock, DAEMON_BACKLOG) == -1)
+    {
+        perror(path);
+        close(sock);
+        return -1;
+    }
+
+    if (willem_open(s) == -1)
+    {
+        fputs(s->error, stderr);
+        close(sock);
+        unlink(path);
+        return -1;
+    }
+
+    willem_reset(s);
+
+    printf("Listening on %s\n", path);
+    fflush(stdout);
+
+    while (!s->terminate)
+    {
+        int fd = accept(sock, NULL, NULL);
+
+        if (fd == -1)
+        {
+            if (errno != EINTR)
+            {
+                perror("accept");
+                break;
+            }
+            continue;
+        }
+
+        daemon_client(b, fd);
+    }
+
+    willem_close(s);
+    close(sock);
+    unlink(path);
+
+    return s->terminate ? 0 : -1;
 }
 
 void usage(const char *argv0)
@@ -256,6 +826,8 @@ void usage(const char *argv0)
                     "\n"
                     "  -p, --port=PORT       select either parport (e.g. /dev/parport0) or physical\n"
                     "                        port (e.g. 0x378). Default is " DEFAULT_PORT ".\n"
+                    "                        Use sim[:OPTIONS] for a simulated board, see README.\n"
+                    "                        Given several times, all boards are programmed at once.\n"
                     "  -E, --eprom           assume EPROM memory\n"
                     "  -F, --flash           assume flash memory\n"
                     "  -i, --id              check memory id (default for flash, optional for EPROM)\n"
@@ -263,37 +835,362 @@ void usage(const char *argv0)
                     "  -b, --blank-check     black check\n"
                     "  -r, --read=FILENAME   read chip to the specified file\n"
                     "  -w, --write=FILENAME  write chip from the specified file\n"
-                    "  -v, --verify          verify after writing\n"
+                    "  -v, --verify          verify every block right after writing it\n"
+                    "  -C, --crc             print CRC-32 of the chip contents\n"
+                    "  --incremental         read the chip first and only program, erase or rewrite\n"
+                    "                        the sectors or pages that differ from the file\n"
+                    "  --daemon=SOCKET       keep the port claimed and run jobs sent to the given\n"
+                    "                        Unix socket, see README for the protocol\n"
+                    "  --resume              continue an interrupted read from the end of the file,\n"
+                    "                        or a write from where its journal left off\n"
                     "  -o, --offset=BYTES    start reading or writing at specified offset\n"
+                    "  -c, --chip=NAME       assume the given chip instead of identifying it, needed\n"
+                    "                        for EPROM programming pulse settings\n"
+                    "  -j, --jumpers=LAYOUT  J3 layout as in README (e.g. 27C010), limits address\n"
+                    "                        shifts to the lines used by the chip\n"
+                    "  -S, --stats           print statistics at the end\n"
+                    "  --report=FILE         write statistics of the run to FILE as JSON\n"
+                    "  --trace=FILE          record every port operation to FILE, see willem3-replay\n"
+                    "  --calibrate           find the shortest bus delays the board and chip work\n"
+                    "                        with and save them to the profile file, with -F -e\n"
+                    "                        flash writes are tested too (the chip is erased)\n"
+                    "  --profile=FILE        timing profiles, default is ~/" PROFILE_FILE "\n"
+                    "  --dry-run             print the expected time and port operations of every\n"
+                    "                        phase instead of running them, a flash chip is only\n"
+                    "                        powered to identify it if --chip is not given\n"
+                    "  -P, --paranoid        read back control register after every update\n"
+                    "  -R, --realtime        lock and prefault memory and run a latency self-test\n"
+                    "  --policy=POLICY       scheduling policy: rr (default), fifo or other\n"
+                    "  --priority=N          real-time priority, default is 1\n"
+                    "  --cpu=N               pin to the given (preferably isolated) CPU\n"
                     "  -s, --size=BYTES      override chip size when reading\n"
                     "  -h, --help            print this message\n"
                     "\n"
                     "File format is binary. Multiple operations may be selected and will be executed\n"
-                    "in the following order: erase, blank check, read or write, verify.\n"
+                    "in the following order: erase, blank check, read or write, verify. Blank check,\n"
+                    "read and CRC share a single pass over the chip.\n"
                     "\n", argv0);
 }
 
-bool terminate = false;
+enum
+{
+    OPT_POLICY = 256,
+    OPT_PRIORITY,
+    OPT_CPU,
+    OPT_INCREMENTAL,
+    OPT_DAEMON,
+    OPT_RESUME,
+    OPT_TRACE,
+    OPT_REPORT,
+    OPT_CALIBRATE,
+    OPT_PROFILE,
+    OPT_DRY_RUN
+};
+
+/* Boards being programmed, one thread each if there are several */
+struct board *boards;
+int board_count;
+
+void handle_signal(int)
+{
+    for (int i = 0; i < board_count; i++)
+    {
+        willem_cancel(&boards[i].s);
+    }
+}
+
+/*
+ * Calibrates the bus timing of a single board and saves it as the profile of
+ * its port and chip.
+ */
+int run_calibrate(struct board *b, struct profiles *profiles, const char *path, bool write_test)
+{
+    struct willem_session *s = &b->s;
+    struct bus_timing t;
+    char key[32];
+    int res;
+
+    s->timing = &willem_calibrate_start;
+
+    if (willem_open(s) == -1)
+    {
+        return -1;
+    }
+
+    willem_reset(s);
+
+    if (willem_power_on(s) == -1)
+    {
+        willem_close(s);
+        return -1;
+    }
+
+    res = willem_calibrate(s, write_test, &t);
+
+    willem_power_off(s);
+    willem_close(s);
+
+    if (res == -1)
+    {
+        return -1;
+    }
+
+    board_chip_key(s, key, sizeof(key));
+    printf("Calibrated timing for %s %s: setup %u ns, settle %u ns, clock %u ns\n", s->port, key, t.setup_ns, t.settle_ns, t.clock_ns);
+
+    if (profiles_save(profiles, path, s->port, key, &t) == -1)
+    {
+        perror(path);
+        return -1;
+    }
+
+    printf("Saved to %s\n", path);
+
+    return 0;
+}
+
+/* Estimates the job of a board, identifying a flash chip if it wasn't selected */
+int run_dry_run(struct board *b)
+{
+    struct willem_session *s = &b->s;
+    struct willem_estimate e;
+    int res;
+
+    if (willem_open(s) == -1)
+    {
+        return -1;
+    }
+
+    willem_reset(s);
+
+    if (s->job->flash && s->job->chip == NULL && willem_power_on(s) == -1)
+    {
+        willem_close(s);
+        return -1;
+    }
+
+    res = willem_estimate(s, &e);
+
+    if (s->powered)
+    {
+        willem_power_off(s);
+    }
+
+    willem_close(s);
+
+    if (res == 0)
+    {
+        print_estimate(s, &e);
+    }
+
+    return res;
+}
+
+/*
+ * Runs a write of a single board, keeping a journal next to the image. The
+ * journal is keyed by the image, the chip and the offset, with resume a
+ * matching one from an interrupted run tells where to continue.
+ */
+int run_write(struct board *b, struct willem_job *job, bool resume)
+{
+    struct willem_session *s = &b->s;
+    char path[PATH_MAX];
+    char key[128];
+    uint32_t done = 0;
+
+    if (willem_open(s) == -1)
+    {
+        return -1;
+    }
+
+    willem_reset(s);
+
+    if (willem_power_on(s) == -1)
+    {
+        willem_close(s);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s.journal", job->do_write);
+    snprintf(key, sizeof(key), "%08x %u %s %u", crc32_update(0, job->image, job->image_len), job->image_len, (s->cc != NULL) ? s->cc->name : "EPROM", job->offset);
+
+    if (journal_open(&b->journal, path, key, resume, &done) == -1)
+    {
+        fprintf(stderr, "%s: %s, continuing without journal\n", path, strerror(errno));
+    }
+
+    if (done > 0)
+    {
+        printf("Resuming write after %u kB\n", done / 1024);
+        job->resume = done;
+    }
+    else if (resume)
+    {
+        printf("No journal of this write, starting over\n");
+    }
+
+    int res = willem_run_job(s, job);
+
+    /* Kept after an interruption or failure, the next run may continue */
+    journal_close(&b->journal, res == 0 && !s->terminate);
+
+    willem_power_off(s);
+    willem_close(s);
+
+    return res;
+}
+
+void *board_thread(void *arg)
+{
+    struct board *b = arg;
+
+    /* Pinning failures are reported by the caller's real-time settings */
+    rt_thread_setup(b->rc, b->cpu);
+
+    b->result = willem_run(&b->s);
+    b->done = true;
+
+    return NULL;
+}
+
+/* Writes the JSON report of all boards */
+void write_report(const char *path, uint64_t start_ns)
+{
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return;
+    }
+
+    report_begin(f, (delay_now() - start_ns) / 1e9);
+
+    for (int i = 0; i < board_count; i++)
+    {
+        report_session(f, &boards[i].s, boards[i].result, i == 0);
+    }
+
+    if (report_end(f) == -1 || fclose(f) == EOF)
+    {
+        perror(path);
+    }
+}
+
+/* Statistics and warnings printed at the end for every board */
+void report(struct willem_session *s, bool stats)
+{
+    if (stats)
+    {
+        print_stats(s);
+    }
+
+    if (s->pp.control_mismatches > 0)
+    {
+        fprintf(stderr, "Control register mismatches: %lu\n", s->pp.control_mismatches);
+    }
+
+    if (s->rt_stats.overruns > 0)
+    {
+        fprintf(stderr, "Critical sections overrun: %lu of %lu\n", s->rt_stats.overruns, s->rt_stats.sections);
+    }
+}
+
+/*
+ * Runs all boards at once, one thread per board, printing their progress
+ * until all of them finish.
+ */
+void run_gang(void)
+{
+    for (int i = 0; i < board_count; i++)
+    {
+        struct board *b = &boards[i];
+        int res = pthread_create(&b->thread, NULL, board_thread, b);
+
+        if (res != 0)
+        {
+            snprintf(b->s.error, sizeof(b->s.error), "pthread_create: %s\n", strerror(res));
+            b->result = -1;
+            b->done = true;
+        }
+    }
+
+    for (bool done = false; !done; )
+    {
+        usleep(GANG_PROGRESS_MSEC * 1000);
+
+        uint32_t total_kb = 0;
+
+        done = true;
+        printf("\r");
+
+        for (int i = 0; i < board_count; i++)
+        {
+            struct board *b = &boards[i];
+
+            if (b->done)
+            {
+                printf("[%d] %-10s ", i, (b->result == 0) ? "done" : "failed");
+            }
+            else
+            {
+                const char *phase = b->s.phase;
+
+                printf("[%d] %s %u kB ", i, (phase != NULL) ? phase : "Starting", b->s.progress_kb);
+                total_kb += b->s.progress_kb;
+                done = false;
+            }
+        }
 
-void handle_signal(int)
-{
-    terminate = true;
+        printf("total %u kB ", total_kb);
+        fflush(stdout);
+    }
+
+    printf("\n");
+
+    for (int i = 0; i < board_count; i++)
+    {
+        struct board *b = &boards[i];
+
+        if (b->thread != 0)
+        {
+            pthread_join(b->thread, NULL);
+        }
+    }
 }
 
 int main(int argc, char **argv)
 {
-    const char *port = DEFAULT_PORT;
+    const char *ports[MAX_PORTS] = { DEFAULT_PORT };
+    int port_count = 0;
     bool do_erase = false;
     bool do_blank_check = false;
     const char *do_read = NULL;
     const char *do_write = NULL;
     bool do_verify = false;
+    bool do_crc = false;
     uint32_t size = 0;
     uint32_t offset = 0;
     bool do_id = false;
     bool flash = false;
     bool eprom = false;
     int do_test = -1;
+    bool paranoid = false;
+    struct jumper_config *jc = NULL;
+    bool stats = false;
+    const char *chip = NULL;
+    bool incremental = false;
+    const char *daemon_path = NULL;
+    const char *trace_path = NULL;
+    const char *report_path = NULL;
+    const char *profile_path = NULL;
+    char default_profile[PATH_MAX];
+    struct profiles profiles;
+    bool calibrate = false;
+    bool dry_run = false;
+    uint64_t start_ns = delay_now();
+    bool resume = false;
+    struct rt_config rc = { SCHED_RR, 1, -1, false, false };
 
     while (true)
     {
@@ -321,14 +1218,31 @@ int main(int argc, char **argv)
             { "read",           required_argument,  0, 'r' },
             { "write",          required_argument,  0, 'w' },
             { "verify",         no_argument,        0, 'v' },
+            { "crc",            no_argument,        0, 'C' },
             { "offset",         required_argument,  0, 'o' },
             { "size",           required_argument,  0, 's' },
+            { "paranoid",       no_argument,        0, 'P' },
+            { "jumpers",        required_argument,  0, 'j' },
+            { "stats",          no_argument,        0, 'S' },
+            { "chip",           required_argument,  0, 'c' },
+            { "realtime",       no_argument,        0, 'R' },
+            { "policy",         required_argument,  0, OPT_POLICY },
+            { "priority",       required_argument,  0, OPT_PRIORITY },
+            { "cpu",            required_argument,  0, OPT_CPU },
+            { "incremental",    no_argument,        0, OPT_INCREMENTAL },
+            { "daemon",         required_argument,  0, OPT_DAEMON },
+            { "resume",         no_argument,        0, OPT_RESUME },
+            { "trace",          required_argument,  0, OPT_TRACE },
+            { "report",         required_argument,  0, OPT_REPORT },
+            { "calibrate",      no_argument,        0, OPT_CALIBRATE },
+            { "profile",        required_argument,  0, OPT_PROFILE },
+            { "dry-run",        no_argument,        0, OPT_DRY_RUN },
             { "help",           no_argument,        0, 'h' },
             { 0,                0,                  0, 0 }
         };
 
         int option_index = 0;
-        int c = getopt_long(argc, argv, "EFip:ebr:w:vs:o:h", long_options, &option_index);
+        int c = getopt_long(argc, argv, "EFip:ebr:w:vCs:o:Pj:Sc:Rh", long_options, &option_index);
 
         if (c == -1)
         {
@@ -364,7 +1278,12 @@ int main(int argc, char **argv)
             break;
 
         case 'p':
-            port = optarg;
+            if (port_count == MAX_PORTS)
+            {
+                fprintf(stderr, "Too many ports, at most %d are supported\n", MAX_PORTS);
+                exit(1);
+            }
+            ports[port_count++] = optarg;
             break;
 
         case 'e':
@@ -386,7 +1305,7 @@ int main(int argc, char **argv)
             break;
 
         case 'w':
-            if (do_id || do_read)
+            if (do_id || do_read || do_crc)
             {
                 fprintf(stderr, "Conflicting options\n");
                 exit(1);
@@ -424,6 +1343,122 @@ int main(int argc, char **argv)
             do_verify = true;
             break;
 
+        case 'C':
+            if (do_write)
+            {
+                fprintf(stderr, "Conflicting options\n");
+                exit(1);
+            }
+            do_crc = true;
+            break;
+
+        case 'P':
+            paranoid = true;
+            break;
+
+        case 'S':
+            stats = true;
+            break;
+
+        case 'c':
+            chip = optarg;
+            break;
+
+        case OPT_INCREMENTAL:
+            incremental = true;
+            break;
+
+        case OPT_DAEMON:
+            daemon_path = optarg;
+            break;
+
+        case OPT_RESUME:
+            resume = true;
+            break;
+
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+
+        case OPT_REPORT:
+            report_path = optarg;
+            break;
+
+        case OPT_CALIBRATE:
+            calibrate = true;
+            break;
+
+        case OPT_PROFILE:
+            profile_path = optarg;
+            break;
+
+        case OPT_DRY_RUN:
+            dry_run = true;
+            break;
+
+        case 'R':
+            rc.lock = true;
+            rc.verbose = true;
+            break;
+
+        case OPT_POLICY:
+            if (strcasecmp(optarg, "rr") == 0)
+            {
+                rc.policy = SCHED_RR;
+            }
+            else if (strcasecmp(optarg, "fifo") == 0)
+            {
+                rc.policy = SCHED_FIFO;
+            }
+            else if (strcasecmp(optarg, "other") == 0)
+            {
+                rc.policy = SCHED_OTHER;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid scheduling policy '%s'\n", optarg);
+                exit(1);
+            }
+            rc.verbose = true;
+            break;
+
+        case OPT_PRIORITY:
+        {
+            char *endptr = NULL;
+            long tmp = strtol(optarg, &endptr, 0);
+            if (tmp < sched_get_priority_min(SCHED_FIFO) || tmp > sched_get_priority_max(SCHED_FIFO) || *endptr != 0)
+            {
+                fprintf(stderr, "Invalid priority '%s'\n", optarg);
+                exit(1);
+            }
+            rc.priority = (int) tmp;
+            rc.verbose = true;
+            break;
+        }
+
+        case OPT_CPU:
+        {
+            char *endptr = NULL;
+            long tmp = strtol(optarg, &endptr, 0);
+            if (tmp < 0 || tmp > INT_MAX || *endptr != 0)
+            {
+                fprintf(stderr, "Invalid CPU '%s'\n", optarg);
+                exit(1);
+            }
+            rc.cpu = (int) tmp;
+            rc.verbose = true;
+            break;
+        }
+
+        case 'j':
+            jc = willem_find_jumpers(optarg);
+            if (jc == NULL)
+            {
+                fprintf(stderr, "Unknown jumper layout '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+
         case 'b':
             if (do_write)
             {
@@ -449,419 +1484,360 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    if (do_verify && !do_write)
+    /* Daemon jobs come from clients, -v and --incremental apply to their writes */
+    if (daemon_path != NULL && (do_erase || do_blank_check || do_read || do_write || do_crc || do_test != -1))
     {
         fprintf(stderr, "Conflicting options\n");
         exit(1);
     }
 
-    set_realtime();
+    if ((do_verify || incremental) && !do_write && daemon_path == NULL)
+    {
+        fprintf(stderr, "Conflicting options\n");
+        exit(1);
+    }
 
-    if (pp_open(&pp, port) == -1)
+    /* A dump can only be continued if nothing else needs the whole chip */
+    if (resume && do_read != NULL && (do_write != NULL || do_blank_check || do_crc))
     {
-        printf("pp_open failed\n");
-        perror(port);
+        fprintf(stderr, "Conflicting options\n");
         exit(1);
     }
 
-    signal(SIGTERM, handle_signal);
-    signal(SIGINT, handle_signal);
+    /* Incremental writes compare the whole chip anyway */
+    if (resume && do_read == NULL && (do_write == NULL || incremental || port_count > 1))
+    {
+        fprintf(stderr, "Conflicting options\n");
+        exit(1);
+    }
 
-    if (do_test != -1)
+    /* Calibration needs the chip to itself, erasing is only allowed for flash write tests */
+    if (calibrate && (do_blank_check || do_read || do_write || do_crc || do_verify || incremental || resume || daemon_path != NULL || do_test != -1 || (eprom && do_erase)))
     {
-        switch (do_test)
-        {
-        case 1: // vcc on
-            pp_wdata(&pp, 0);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_INIT);
-            break;
-        case 3: // vpp on
-            pp_wdata(&pp, 0);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_STROBE);
-            break;
-        case 6: // s4 low
-            pp_wdata(&pp, 0);
-            pp_wcontrol(&pp, 0);
-            break;
-        case 8: // s6 low
-            pp_wdata(&pp, 0);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_AUTOFD);
-            break;
-        case 9: // d high
-            pp_wdata(&pp, 2);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT);
-            break;
-        case 11:    // clk high
-            pp_wdata(&pp, 1);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT);
-            break;
-        default:
-            pp_wdata(&pp, 0);
-            pp_wcontrol(&pp, PARPORT_CONTROL_SELECT);
-            break;
-        }
-        exit(0);
+        fprintf(stderr, "Conflicting options\n");
+        exit(1);
     }
 
-    pp_wdata(&pp, 0);
-    set_s4(true);
-    set_s6(true);
-    set_vpp(false);
-    set_vcc(false);
+    if (dry_run && (calibrate || daemon_path != NULL || do_test != -1))
+    {
+        fprintf(stderr, "Conflicting options\n");
+        exit(1);
+    }
 
-    if (!eprom && !flash)
+    if (!eprom && !flash && do_test == -1)
     {
         fprintf(stderr, "Need to select memory type\n");
         exit(1);
     }
 
-    set_vcc(true);
+    if (port_count == 0)
+    {
+        port_count = 1;
+    }
+
+    if ((do_read != NULL || daemon_path != NULL || calibrate) && port_count > 1)
+    {
+        fprintf(stderr, "%s needs a single port\n", (do_read != NULL) ? "Reading" : (calibrate ? "Calibration" : "Daemon mode"));
+        exit(1);
+    }
 
-    usleep(100000);
+    if (profile_path == NULL)
+    {
+        const char *home = getenv("HOME");
 
-    struct chip_config *cc = NULL;
+        snprintf(default_profile, sizeof(default_profile), "%s/" PROFILE_FILE, (home != NULL) ? home : ".");
+        profile_path = default_profile;
+    }
 
-    if (flash)
+    /* A broken profile file only costs speed, unless it is to be updated */
+    if (profiles_load(&profiles, profile_path) == -1)
     {
-        uint16_t chip_id = flash_id();
+        perror(profile_path);
 
-        for (int i = 0; i < sizeof(chip_config) / sizeof(chip_config[0]); ++i)
+        if (calibrate)
         {
-            if (chip_id == chip_config[i].id)
-            {
-                cc = &chip_config[i];
-                break;
-            }
+            exit(1);
         }
+    }
+
+    struct willem_job job =
+    {
+        .eprom = eprom,
+        .flash = flash,
+        .do_erase = do_erase,
+        .do_blank_check = do_blank_check,
+        .do_read = (do_read != NULL),
+        .do_write = do_write,
+        .do_verify = do_verify,
+        .do_crc = do_crc,
+        .incremental = incremental,
+        .do_test = do_test,
+        .paranoid = paranoid,
+        .size = size,
+        .offset = offset,
+        .chip = chip,
+        .jc = jc
+    };
+
+    /* Every board is programmed from the same copy */
+    uint8_t *image = NULL;
+
+    if (do_write != NULL)
+    {
+        image = load_file(do_write, &job.image_len);
 
-        if (cc == NULL) 
+        if (image == NULL)
         {
-            fprintf(stderr, "Chip id 0x%04x not supported\n", chip_id);
-            goto failure;
+            perror(do_write);
+            exit(1);
         }
 
-        printf("Chip id 0x%04x (%s)\n", chip_id, cc->name);
+        job.image = image;
+    }
 
-        if (size == 0)
-        {
-            size = cc->size;
-        }
+    /* Board threads are pinned separately, keep the main thread free */
+    int first_cpu = rc.cpu;
+
+    if (port_count > 1)
+    {
+        rc.cpu = -1;
     }
-    else
+
+    /* Failures are only reported if a real-time setting was requested */
+    if (rt_setup(&rc) == -1 && rc.verbose)
     {
-        if (do_read && size == 0)
-        {
-            fprintf(stderr, "Need to provide memory size\n");
-            exit(1);
-        }
+        fprintf(stderr, "Warning: real-time profile incomplete, timing may suffer\n");
     }
 
-    if (flash && do_erase)
+    /* Even if locking failed, the image is not paged in while writing */
+    if (rc.lock && image != NULL)
     {
-        flash_erase();
+        rt_prefault(image, job.image_len);
+    }
 
-        printf("Erasing...");
-        fflush(stdout);
+    delay_init();
 
-        /* Wait while the bit is toggling */
-        while (!terminate)
-        {
-            uint8_t data1 = read_data(0, false);
-            uint8_t data2 = read_data(0, false);
+    if (rc.lock)
+    {
+        struct rt_latency lat;
 
-            if (data1 == 0xff && data2 == 0xff)
-            {
-                break;
-            }
+        rt_latency_test(&lat, LATENCY_TEST_MSEC);
 
-            usleep(100000);
-        }
+        printf("Latency: worst wakeup %.1f us, worst preemption %.1f us\n",
+               lat.worst_wakeup_ns / 1e3, lat.worst_gap_ns / 1e3);
 
-        if (!terminate)
+        if (lat.worst_gap_ns > TBLC_LOAD_USEC * 1000ULL)
         {
-            printf("\nErase complete\n");
+            fprintf(stderr, "Warning: scheduling latency exceeds the %d us page load window\n", TBLC_LOAD_USEC);
         }
     }
 
-    if (!terminate && eprom && do_erase)
-    {
-        write_address(0);
-        set_s6(true);
-        pp_wdata(&pp, 0xff);
-
-        set_vpp(true);
-        set_s4(false);
-        usleep(100000);
-        set_s4(true);
-        set_vpp(false);
+    boards = malloc(port_count * sizeof(boards[0]));
 
-        printf("Erase complete\n");
+    if (boards == NULL)
+    {
+        perror("malloc");
+        exit(1);
     }
 
-    if (!terminate && do_blank_check)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 0; i < port_count; i++)
     {
-        uint32_t addr;
+        struct board *b = &boards[i];
+
+        board_init(b, ports[i], &job);
+        b->rc = &rc;
+        b->gang = (port_count > 1);
 
-        for (addr = 0; !terminate && addr < size; ++addr)
+        /* Chips are identified at the slowest timing calibrated on the port */
+        if (!calibrate && profiles_port_max(&profiles, ports[i], &b->port_timing))
         {
-            if (addr % 1024 == 0)
+            b->profiles = &profiles;
+            b->s.timing = &b->port_timing;
+        }
+
+        /* Each board of a gang gets its own trace */
+        if (trace_path != NULL)
+        {
+            if (port_count > 1)
             {
-                printf("\rBlank check %u kB...", addr / 1024);
-                fflush(stdout);
+                snprintf(b->trace, sizeof(b->trace), "%s.%d", trace_path, i);
             }
-
-            uint8_t byte = read_data(offset + addr, eprom);
-
-            if (byte != 0xff)
+            else
             {
-                printf("\n");
-                fprintf(stderr, "Black check failed at 0x%08x: 0x%02x\n", offset + addr, byte);
-                goto failure;
+                snprintf(b->trace, sizeof(b->trace), "%s", trace_path);
             }
+
+            b->s.trace = b->trace;
         }
 
-        if (!terminate)
+        /* One CPU per board, starting at --cpu if given */
+        if (first_cpu != -1)
+        {
+            b->cpu = first_cpu + i;
+        }
+        else
         {
-            printf("\nBlank check complete\n");
+            b->cpu = (cpus > 0) ? i % cpus : -1;
         }
     }
 
-    if (!terminate && do_read != NULL)
+    board_count = port_count;
+
+    if (do_read != NULL && !dry_run)
     {
-        int fd = open(do_read, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        char key[128];
 
-        if (fd == -1)
-        {
-            perror(do_read);
-            goto failure;
-        }
+        snprintf(key, sizeof(key), "read %s %s %u %u %s", eprom ? "EPROM" : "flash", (chip != NULL) ? chip : "-", offset, size, (jc != NULL) ? jc->name : "-");
 
-        uint8_t *buf = malloc(size);
+        off_t done = board_read_open(&boards[0], do_read, offset, size, key, resume);
 
-        if (buf == NULL)
+        if (done == -1)
         {
-            perror("malloc");
-            close(fd);
-            goto failure;
+            perror(do_read);
+            exit(1);
         }
 
-        uint32_t addr;
-
-        for (addr = 0; !terminate && addr < size; addr++)
+        if (done > 0)
         {
-            if (addr % 1024 == 0)
-            {
-                printf("\rReading %u kB...", addr / 1024);
-                fflush(stdout);
-            }
-            buf[addr] = read_data(offset + addr, eprom);
+            job.resume = (done > UINT32_MAX) ? UINT32_MAX : done;
+            printf("Resuming read after %u kB\n", job.resume / 1024);
         }
-        
-        if (!terminate)
+        else if (resume)
         {
-            printf("\nRead complete\n");
-
-            if (write(fd, buf, size) != size)
-            {
-                perror("write");
-                free(buf);
-                close(fd);
-                goto failure;
-            }
+            printf("Nothing of this read to keep, starting over\n");
         }
-
-        free(buf);
-        close(fd);
     }
 
-    if (!terminate && eprom && do_write != NULL)
-    {
-        int fd = open(do_write, O_RDONLY);
-
-        if (fd == -1)
-        {
-            perror(do_write);
-            goto failure;
-        }
-
-        uint8_t buf[1024];
-        uint32_t addr = 0;
-        ssize_t read_len;
+    /* Without SA_RESTART, so that a waiting daemon notices the signal */
+    struct sigaction sa;
 
-        /* Store size for verification */
-        size = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
 
-        set_vpp(true);
+    /* Boards are estimated one after another, nothing is written */
+    if (dry_run)
+    {
+        int failed = 0;
 
-        while (!terminate && (read_len = read(fd, buf, sizeof(buf))) > 0)
+        for (int i = 0; i < board_count; i++)
         {
-            if (addr % 1024 == 0)
+            /* A single board has reported its error already */
+            if (run_dry_run(&boards[i]) == -1)
             {
-                printf("\rWriting %u kB...", addr / 1024);
-                fflush(stdout);
-            }
-
-            for (size_t i = 0; i < read_len; ++i)
-            {
-                if (buf[i] != 0xff)
-                {
-                    //printf("Writing offset %d value %d\n", addr, buf[i]);
-                    write_data_w_delay(offset + addr, buf[i], 100);
-                    usleep(100);
-                }
-                else
+                if (boards[i].gang)
                 {
-                    //printf("Skipping offset %d value 255\n", addr);
+                    fprintf(stderr, "[%d] %s", i, boards[i].s.error);
                 }
-                addr++;
+                failed++;
             }
-            size += read_len;
         }
 
-        set_vpp(false);
-
-        if (!terminate)
-        {
-            printf("\nWrite complete\n");
-        }
+        free(image);
 
-        close(fd);
+        return (failed == 0) ? 0 : 1;
     }
 
-    if (!terminate && flash && do_write != NULL)
+    if (daemon_path != NULL)
     {
-        int fd = open(do_write, O_RDONLY);
+        /* Disconnected clients are noticed on the next read */
+        signal(SIGPIPE, SIG_IGN);
 
-        if (fd == -1)
+        int res = daemon_run(&boards[0], daemon_path);
+
+        report(&boards[0].s, stats);
+
+        if (report_path != NULL)
         {
-            perror(do_write);
-            goto failure;
+            boards[0].result = res;
+            write_report(report_path, start_ns);
         }
 
-        const size_t buffer_len = (cc->sector_size > 0) ? cc->sector_size : 1024;
-        uint8_t buf[buffer_len];
-        uint32_t addr = 0;
-        ssize_t read_len;
+        return (res == 0) ? 0 : 1;
+    }
 
-        /* Store size for verification */
-        size = 0;
+    if (board_count == 1)
+    {
+        int res;
 
-        while (!terminate && (read_len = read(fd, buf, buffer_len)) > 0)
+        if (calibrate)
         {
-            if (addr % 1024 == 0)
-            {
-                printf("\rWriting %u kB...", addr / 1024);
-                fflush(stdout);
-            }
+            res = run_calibrate(&boards[0], &profiles, profile_path, do_erase);
+        }
+        else if (do_write != NULL && !incremental && do_test == -1)
+        {
+            res = run_write(&boards[0], &job, resume);
+        }
+        else
+        {
+            res = willem_run(&boards[0].s);
+        }
 
-            if (cc->sector_size > 0)
-            {
-                bool empty = true;
-                for (size_t i = 0; empty && i < read_len; ++i)
-                {
-                    if (buf[i] != 0xff)
-                    {
-                        empty = false;
-                    }
-                }
+        free(image);
 
-                if (!empty)
-                {
-                    flash_write(offset + addr, buf, read_len);
-                    usleep(cc->max_write_usec);
-                }
-                addr += cc->sector_size;
-                size += read_len;
-            }
-            else
-            {
-                for (size_t i = 0; i < read_len; ++i)
-                {
-                    if (buf[i] != 0xff)
-                    {
-                        flash_write(offset + addr, &buf[i], 1);
-                        usleep(cc->max_write_usec);
-                    }
-                    addr++;
-                }
-                size += read_len;
-            }
+        if (boards[0].writer != NULL && board_read_close(&boards[0], res == 0 && !boards[0].s.terminate) == -1)
+        {
+            perror(do_read);
+            res = -1;
         }
 
-        if (!terminate)
+        report(&boards[0].s, stats);
+
+        if (report_path != NULL)
         {
-            printf("\nWrite complete\n");
+            boards[0].result = res;
+            write_report(report_path, start_ns);
         }
 
-        close(fd);
+        return (res == 0) ? 0 : 1;
     }
 
-    if (!terminate && do_verify && do_write != NULL)
-    {
-        int fd = open(do_write, O_RDONLY);
+    run_gang();
+    free(image);
 
-        if (fd == -1)
-        {
-            perror(do_write);
-            goto failure;
-        }
+    int failed = 0;
 
-        uint8_t *buf = malloc(size);
+    for (int i = 0; i < board_count; i++)
+    {
+        struct board *b = &boards[i];
+        struct willem_session *s = &b->s;
 
-        if (buf == NULL)
+        if (b->result == 0)
         {
-            perror("malloc");
-            close(fd);
-            goto failure;
+            printf("[%d] %s: %s", i, s->port, s->terminate ? "interrupted" : "PASS");
         }
-
-        if (read(fd, buf, size) != size)
+        else
         {
-            perror(do_read);
-            close(fd);
-            free(buf);
-            goto failure;
+            printf("[%d] %s: FAIL", i, s->port);
+            failed++;
         }
 
-        close(fd);
-
-        uint32_t addr;
-
-        for (addr = 0; !terminate && addr < size; addr++)
+        if (s->cc != NULL)
         {
-            if (addr % 1024 == 0)
-            {
-                printf("\rVerifying %u kB...", addr / 1024);
-                fflush(stdout);
-            }
-
-            uint8_t byte = read_data(offset + addr, eprom);
-
-            if (byte != buf[addr])
-            {
-                printf("\n");
-                fprintf(stderr, "Verification failed at 0x%08x: expected 0x%02x, actual 0x%02x\n", offset + addr, buf[addr], byte);
-                free(buf);
-                goto failure;
-            }
+            printf(" (%s)", s->cc->name);
         }
 
-        if (!terminate)
+        printf("\n");
+        fflush(stdout);
+
+        if (b->result != 0 && s->error[0] != 0)
         {
-            printf("\nVerify complete\n");
+            fprintf(stderr, "[%d] %s", i, s->error);
         }
 
-        free(buf);
+        report(s, stats);
     }
 
-    printf("Turning off\n");
-    set_vcc(false);
-    usleep(100000);
-    pp_close(&pp);
-    return 0;
+    printf("%d of %d boards passed\n", board_count - failed, board_count);
 
-failure:
-    set_vcc(false);
-    pp_close(&pp);
-    return 1;
+    if (report_path != NULL)
+    {
+        write_report(report_path, start_ns);
+    }
+
+    return (failed == 0) ? 0 : 1;
 }
+
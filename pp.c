@@ -31,58 +31,78 @@
  */
 
 #include "pp.h"
+#include "pp_backend.h"
+#include "sim.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
-#include <sys/io.h>
-#include <linux/ppdev.h>
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
-#define CONTROL_MASK 0x0b
-#define STATUS_MASK 0x80
-
-int pp_rstatus(const pp_t *p)
+int pp_rstatus(pp_t *p)
 {
-	unsigned char val;
+	int val;
+
+	p->ops++;
 
 	switch (p->type)
     {
 		case PP_DIRECT:
-			return inb(p->port + 1) ^ STATUS_MASK;
+			val = pp_direct_rstatus(p);
+			break;
 
 		case PP_PARPORT:
-			if (ioctl(p->fd, PPRSTATUS, &val) == -1)
-				return -1;
+			val = pp_parport_rstatus(p);
+			break;
 
-			return val ^ STATUS_MASK;
+		case PP_SIM:
+			val = sim_rstatus(p->sim);
+			break;
 
         default:
             return -1;
 	}
+
+	if (p->trace != NULL)
+		trace_add(p->trace, pp_time(p), TRACE_RSTATUS, val, 0);
+
+	return val;
 }
 
-int pp_wcontrol(const pp_t *p, unsigned char val)
+int pp_wcontrol(pp_t *p, unsigned char val)
 {
-	val ^= CONTROL_MASK;
+	int res;
+
+	p->control = val;
+	p->ops++;
 
 	switch (p->type)
     {
 		case PP_DIRECT:
-			outb(val, p->port + 2);
-			return 0;
+			res = pp_direct_wcontrol(p, val);
+			break;
 
 		case PP_PARPORT:
-			return ioctl(p->fd, PPWCONTROL, &val);
+			res = pp_parport_wcontrol(p, val);
+			break;
+
+		case PP_SIM:
+			res = sim_wcontrol(p->sim, val);
+			break;
 
         default:
             return -1;
 	}
+
+	if (p->trace != NULL)
+		trace_add(p->trace, pp_time(p), TRACE_WCONTROL, val, 0);
+
+	return res;
 }
 
 int pp_rcontrol(const pp_t *p)
@@ -92,33 +112,88 @@ int pp_rcontrol(const pp_t *p)
 	switch (p->type)
     {
 		case PP_DIRECT:
-			return inb(p->port + 2) ^ CONTROL_MASK;
+			return inb(p->port + 2) ^ PP_CONTROL_MASK;
 
 		case PP_PARPORT:
 			if (ioctl(p->fd, PPRCONTROL, &val) == -1)
 				return -1;
 
-			return val ^ CONTROL_MASK;
+			return val ^ PP_CONTROL_MASK;
+
+		case PP_SIM:
+			return sim_rcontrol(p->sim);
 
         default:
         	return -1;
 	}
 }
 
-int pp_wdata(const pp_t *p, unsigned char val)
+/*
+ * Updates bits selected by mask in the control register using the shadow
+ * copy instead of reading the port first. Nothing is written if the bits
+ * already have the requested value. In paranoid mode the port is read back
+ * and compared with the shadow copy, which is resynchronised on mismatch.
+ */
+int pp_ucontrol(pp_t *p, unsigned char mask, unsigned char val)
 {
+	int control = (p->control & ~mask) | (val & mask);
+	int res = 0;
+
+	if (control != p->control)
+    {
+		res = pp_wcontrol(p, control);
+    }
+
+	if (p->paranoid && res != -1)
+    {
+		int actual = pp_rcontrol(p);
+
+		if (actual == -1)
+        {
+			return -1;
+        }
+
+		if ((actual & 0x0f) != (control & 0x0f))
+        {
+			p->control_mismatches++;
+			p->control = actual;
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return res;
+}
+
+int pp_wdata(pp_t *p, unsigned char val)
+{
+	int res;
+
+	p->data = val;
+	p->ops++;
+
 	switch (p->type)
     {
 		case PP_DIRECT:
-			outb(val, p->port);
-			return 0;
+			res = pp_direct_wdata(p, val);
+			break;
 
 		case PP_PARPORT:
-			return ioctl(p->fd, PPWDATA, &val);
+			res = pp_parport_wdata(p, val);
+			break;
+
+		case PP_SIM:
+			res = sim_wdata(p->sim, val);
+			break;
 
         default:
         	return -1;
 	}
+
+	if (p->trace != NULL)
+		trace_add(p->trace, pp_time(p), TRACE_WDATA, val, 0);
+
+	return res;
 }
 
 int pp_rdata(const pp_t *p)
@@ -136,11 +211,113 @@ int pp_rdata(const pp_t *p)
 
 			return val;
 
+		case PP_SIM:
+			return sim_rdata(p->sim);
+
         default:
         	return -1;
 	}
 }
 
+int pp_ndelay(pp_t *p, uint64_t nsec)
+{
+	if (p->trace != NULL)
+		trace_add(p->trace, pp_time(p), TRACE_DELAY, 0, nsec / 1000);
+
+	switch (p->type)
+    {
+		case PP_SIM:
+			sim_ndelay(p->sim, nsec);
+			p->delays.count++;
+			p->delays.requested_ns += nsec;
+			p->delays.actual_ns += nsec;
+			return 0;
+
+        default:
+			delay_ns(&p->delays, nsec);
+			return 0;
+	}
+}
+
+int pp_udelay(pp_t *p, unsigned int usec)
+{
+	return pp_ndelay(p, usec * 1000ULL);
+}
+
+/*
+ * Returns monotonic time in nanoseconds, simulated time for PP_SIM.
+ */
+uint64_t pp_time(const pp_t *p)
+{
+	struct timespec ts;
+
+	if (p->type == PP_SIM)
+		return sim_time(p->sim);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Starts recording port operations to the given file. Returns 0 on success,
+ * -1 on failure with errno set.
+ */
+int pp_trace_open(pp_t *p, const char *path, const char *port)
+{
+	p->trace = trace_open(path, port, pp_time(p));
+
+	return (p->trace != NULL) ? 0 : -1;
+}
+
+/* Records the current phase, between blocks of the phase */
+void pp_trace_phase(pp_t *p, const char *phase, long kb)
+{
+	if (p->trace != NULL)
+		trace_phase(p->trace, pp_time(p), phase, kb);
+}
+
+void pp_trace_mark(pp_t *p, int op)
+{
+	if (p->trace != NULL)
+		trace_add(p->trace, pp_time(p), op, 0, 0);
+}
+
+/* Returns 0 if the whole trace has been written, -1 with errno set otherwise */
+int pp_trace_close(pp_t *p)
+{
+	int res = 0;
+
+	if (p->trace != NULL)
+    {
+		res = trace_close(p->trace);
+		p->trace = NULL;
+	}
+
+	return res;
+}
+
+static int pp_attach(pp_t *p)
+{
+	p->control = pp_rcontrol(p);
+	p->data = pp_rdata(p);
+	p->control_mismatches = 0;
+	p->ops = 0;
+	p->trace = NULL;
+	memset(&p->delays, 0, sizeof(p->delays));
+
+	/* Not left claimed if its registers cannot be read */
+	if (p->control == -1 || p->data == -1)
+	{
+		int errno_save = errno;
+		pp_close(p);
+		errno = errno_save;
+		return -1;
+	}
+
+	return 0;
+}
+
 int pp_open(pp_t *p, const char *port)
 {
     if (port == NULL)
@@ -168,7 +345,7 @@ int pp_open(pp_t *p, const char *port)
 			return -1;
 		}
 
-		return 0;
+		return pp_attach(p);
 	}
 
 	if (strncmp(port, "0x", 2) == 0)
@@ -176,7 +353,27 @@ int pp_open(pp_t *p, const char *port)
 		p->type = PP_DIRECT;
 		p->port = strtoul(port, NULL, 0);
 
-	    return ioperm(p->port, 3, 1);
+		if (ioperm(p->port, 3, 1) == -1)
+        {
+			return -1;
+        }
+
+		return pp_attach(p);
+	}
+
+	if (strncmp(port, "sim", 3) == 0 && (port[3] == 0 || port[3] == ':'))
+    {
+		p->sim = sim_open((port[3] == ':') ? port + 4 : NULL);
+
+		if (p->sim == NULL)
+        {
+			errno = EINVAL;
+			return -1;
+        }
+
+		p->type = PP_SIM;
+
+		return pp_attach(p);
 	}
 
 	return -1;
@@ -200,6 +397,12 @@ int pp_close(pp_t *p)
             p->type = PP_NONE;
             return ioperm(p->port, 3, 0);
 
+		case PP_SIM:
+			sim_close(p->sim);
+			p->sim = NULL;
+            p->type = PP_NONE;
+			return 0;
+
         default:
 	        p->type = PP_NONE;
 	        return -1;
@@ -33,37 +33,75 @@
 #ifndef PP_H
 #define PP_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <linux/parport.h>
 
+#include "delay.h"
+#include "trace.h"
+
 typedef enum
 {
     PP_NONE = 0,
     PP_PARPORT,
-    PP_DIRECT
+    PP_DIRECT,
+    PP_SIM
 } pp_type_t;
 
 #define PP_PARPORT PP_PARPORT
 #define PP_DIRECT PP_DIRECT
+#define PP_SIM PP_SIM
+
+/* Wave entry the bus play loop samples ACK for instead of writing data */
+#define PP_OP_SAMPLE 0x100
 
 typedef struct
 {
     pp_type_t type;
 
+    /* Last value written to the data register */
+    int data;
+
+    /* Shadow copy of the control register */
+    int control;
+    /* Read back the control register after every update */
+    bool paranoid;
+    unsigned long control_mismatches;
+
+    struct delay_stats delays;
+
+    /* Data and control writes and status reads */
+    unsigned long ops;
+
+    /* Port operation trace or NULL */
+    struct trace *trace;
+
     /* PP_PARPORT */
     int fd;
 
     /* PP_DIRECT */
     int port;
+
+    /* PP_SIM */
+    struct sim *sim;
 } pp_t;
 
 int pp_open(pp_t *p, const char *path);
 int pp_close(pp_t *p);
 
-int pp_rstatus(const pp_t *p);
-int pp_wcontrol(const pp_t *p, unsigned char val);
+int pp_rstatus(pp_t *p);
+int pp_wcontrol(pp_t *p, unsigned char val);
 int pp_rcontrol(const pp_t *p);
-int pp_wdata(const pp_t *p, unsigned char val);
+int pp_ucontrol(pp_t *p, unsigned char mask, unsigned char val);
+int pp_wdata(pp_t *p, unsigned char val);
 int pp_rdata(const pp_t *p);
+int pp_udelay(pp_t *p, unsigned int usec);
+int pp_ndelay(pp_t *p, uint64_t nsec);
+uint64_t pp_time(const pp_t *p);
+int pp_trace_open(pp_t *p, const char *path, const char *port);
+void pp_trace_phase(pp_t *p, const char *phase, long kb);
+void pp_trace_mark(pp_t *p, int op);
+int pp_trace_close(pp_t *p);
 
 #endif /* PP_H */
 
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PP_BACKEND_H
+#define PP_BACKEND_H
+
+/*
+ * Register access primitives of the hardware backends. Code specialised for
+ * a single backend uses them directly, everything else goes through pp.h.
+ */
+
+#include "pp.h"
+
+#include <sys/ioctl.h>
+#include <sys/io.h>
+#include <linux/ppdev.h>
+
+#define PP_CONTROL_MASK 0x0b
+#define PP_STATUS_MASK 0x80
+
+static inline int pp_direct_wdata(pp_t *p, unsigned char val)
+{
+    outb(val, p->port);
+    return 0;
+}
+
+static inline int pp_direct_wcontrol(pp_t *p, unsigned char val)
+{
+    outb(val ^ PP_CONTROL_MASK, p->port + 2);
+    return 0;
+}
+
+static inline int pp_direct_rstatus(const pp_t *p)
+{
+    return inb(p->port + 1) ^ PP_STATUS_MASK;
+}
+
+static inline int pp_parport_wdata(pp_t *p, unsigned char val)
+{
+    return ioctl(p->fd, PPWDATA, &val);
+}
+
+static inline int pp_parport_wcontrol(pp_t *p, unsigned char val)
+{
+    val ^= PP_CONTROL_MASK;
+    return ioctl(p->fd, PPWCONTROL, &val);
+}
+
+static inline int pp_parport_rstatus(const pp_t *p)
+{
+    unsigned char val;
+
+    if (ioctl(p->fd, PPRSTATUS, &val) == -1)
+    {
+        return -1;
+    }
+
+    return val ^ PP_STATUS_MASK;
+}
+
+#endif /* PP_BACKEND_H */
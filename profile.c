@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Timing profiles saved by --calibrate. Each line holds a port, a chip
+ * (flash id or chip name), and the write setup, read settle and clock
+ * pacing delays in nanoseconds. Empty lines and lines starting with # are
+ * kept as they are.
+ */
+
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define PROFILE_LINE_MAX 512
+
+/* Splits a profile line, returns false for comments and malformed lines */
+static bool profile_parse(const char *line, char *port, char *chip, struct bus_timing *t)
+{
+    char extra;
+
+    if (line[0] == '#')
+    {
+        return false;
+    }
+
+    return sscanf(line, "%255s %255s %u %u %u %c", port, chip, &t->setup_ns, &t->settle_ns, &t->clock_ns, &extra) == 5;
+}
+
+/*
+ * Reads the profiles from path, a missing file has none. Returns 0 on
+ * success, -1 on failure with errno set.
+ */
+int profiles_load(struct profiles *p, const char *path)
+{
+    char line[PROFILE_LINE_MAX];
+    FILE *f;
+
+    p->lines = NULL;
+    p->count = 0;
+
+    f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char **lines = realloc(p->lines, (p->count + 1) * sizeof(p->lines[0]));
+
+        line[strcspn(line, "\n")] = 0;
+
+        if (lines == NULL || (lines[p->count] = strdup(line)) == NULL)
+        {
+            int saved_errno = errno;
+
+            if (lines != NULL)
+            {
+                p->lines = lines;
+            }
+
+            fclose(f);
+            profiles_free(p);
+            errno = saved_errno;
+
+            return -1;
+        }
+
+        p->lines = lines;
+        p->count++;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+/* Looks up the timing calibrated for the chip on the port */
+bool profiles_find(const struct profiles *p, const char *port, const char *chip, struct bus_timing *t)
+{
+    char line_port[256], line_chip[256];
+    struct bus_timing tmp;
+
+    for (int i = 0; i < p->count; i++)
+    {
+        if (profile_parse(p->lines[i], line_port, line_chip, &tmp) && strcmp(line_port, port) == 0 && strcmp(line_chip, chip) == 0)
+        {
+            *t = tmp;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The longest delays of all chips calibrated on the port, safe to identify
+ * any of them with. Returns false if the port has no profiles.
+ */
+bool profiles_port_max(const struct profiles *p, const char *port, struct bus_timing *t)
+{
+    char line_port[256], line_chip[256];
+    struct bus_timing tmp;
+    bool found = false;
+
+    for (int i = 0; i < p->count; i++)
+    {
+        if (!profile_parse(p->lines[i], line_port, line_chip, &tmp) || strcmp(line_port, port) != 0)
+        {
+            continue;
+        }
+
+        if (!found)
+        {
+            *t = tmp;
+            found = true;
+            continue;
+        }
+
+        t->setup_ns = (tmp.setup_ns > t->setup_ns) ? tmp.setup_ns : t->setup_ns;
+        t->settle_ns = (tmp.settle_ns > t->settle_ns) ? tmp.settle_ns : t->settle_ns;
+        t->clock_ns = (tmp.clock_ns > t->clock_ns) ? tmp.clock_ns : t->clock_ns;
+    }
+
+    return found;
+}
+
+/*
+ * Sets the timing of the chip on the port, replacing an earlier one, and
+ * writes all profiles to path through a temporary file. Returns 0 on
+ * success, -1 on failure with errno set.
+ */
+int profiles_save(struct profiles *p, const char *path, const char *port, const char *chip, const struct bus_timing *t)
+{
+    char line[PROFILE_LINE_MAX], line_port[256], line_chip[256];
+    char tmp_path[PROFILE_LINE_MAX];
+    struct bus_timing tmp;
+    int index = p->count;
+    char *text;
+    FILE *f;
+
+    snprintf(line, sizeof(line), "%s %s %u %u %u", port, chip, t->setup_ns, t->settle_ns, t->clock_ns);
+
+    for (int i = 0; i < p->count; i++)
+    {
+        if (profile_parse(p->lines[i], line_port, line_chip, &tmp) && strcmp(line_port, port) == 0 && strcmp(line_chip, chip) == 0)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    text = strdup(line);
+
+    if (text == NULL)
+    {
+        return -1;
+    }
+
+    if (index == p->count)
+    {
+        char **lines = realloc(p->lines, (p->count + 1) * sizeof(p->lines[0]));
+
+        if (lines == NULL)
+        {
+            free(text);
+            return -1;
+        }
+
+        p->lines = lines;
+        p->lines[p->count++] = text;
+    }
+    else
+    {
+        free(p->lines[index]);
+        p->lines[index] = text;
+    }
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    f = fopen(tmp_path, "w");
+
+    if (f == NULL)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < p->count; i++)
+    {
+        fprintf(f, "%s\n", p->lines[i]);
+    }
+
+    if (fclose(f) == EOF || rename(tmp_path, path) == -1)
+    {
+        int saved_errno = errno;
+
+        remove(tmp_path);
+        errno = saved_errno;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void profiles_free(struct profiles *p)
+{
+    for (int i = 0; i < p->count; i++)
+    {
+        free(p->lines[i]);
+    }
+
+    free(p->lines);
+    p->lines = NULL;
+    p->count = 0;
+}
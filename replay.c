@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replays a port operation trace recorded with willem3 --trace against a
+ * simulated board and prints statistics of the recorded run per phase.
+ */
+
+#include "pp.h"
+#include "trace.h"
+#include "willem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#define DEFAULT_PORT "sim"
+#define READ_RECORDS 65536              /* Records read from the file at once */
+#define HISTOGRAM_BUCKETS 15            /* Powers of two from 256 ns up */
+#define HISTOGRAM_MIN_NSEC 256
+#define LONGEST_GAPS 10                 /* Longest page load gaps listed */
+
+/* Status bits driven by the board */
+#define STATUS_MASK 0xf8
+
+struct phase_stats
+{
+    uint64_t time_ns;
+    unsigned long ops;
+    unsigned long kb;
+    uint64_t delay_us;
+    unsigned long mismatches;
+    unsigned long histogram[HISTOGRAM_BUCKETS];
+};
+
+struct gap
+{
+    uint64_t gap_ns;
+    uint64_t at_ns;
+    int phase;
+};
+
+static struct phase_stats stats[TRACE_PHASES];
+static struct gap longest[LONGEST_GAPS];
+
+static void add_histogram(struct phase_stats *ps, uint64_t gap)
+{
+    int i = 0;
+
+    while (i < HISTOGRAM_BUCKETS - 1 && gap >= (HISTOGRAM_MIN_NSEC << i))
+    {
+        i++;
+    }
+
+    ps->histogram[i]++;
+}
+
+/* Keeps the longest gaps sorted, longest first */
+static void add_gap(uint64_t gap, uint64_t at, int phase)
+{
+    int i = LONGEST_GAPS;
+
+    while (i > 0 && longest[i - 1].gap_ns < gap)
+    {
+        if (i < LONGEST_GAPS)
+        {
+            longest[i] = longest[i - 1];
+        }
+
+        i--;
+    }
+
+    if (i < LONGEST_GAPS)
+    {
+        longest[i] = (struct gap) { gap, at, phase };
+    }
+}
+
+static void print_histogram(const struct phase_stats *ps)
+{
+    unsigned long max = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if (ps->histogram[i] > max)
+        {
+            max = ps->histogram[i];
+        }
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if (ps->histogram[i] == 0)
+        {
+            continue;
+        }
+
+        if (i < HISTOGRAM_BUCKETS - 1)
+        {
+            printf("  < %8.1f us %10lu ", (HISTOGRAM_MIN_NSEC << i) / 1000.0, ps->histogram[i]);
+        }
+        else
+        {
+            printf("  >=%8.1f us %10lu ", (HISTOGRAM_MIN_NSEC << (i - 1)) / 1000.0, ps->histogram[i]);
+        }
+
+        for (unsigned long j = 0; j < ps->histogram[i] * 40 / max; j++)
+        {
+            putchar('#');
+        }
+
+        putchar('\n');
+    }
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [OPTIONS] TRACE\n"
+                    "\n"
+                    "  -p, --port=PORT       simulated board to replay against, e.g.\n"
+                    "                        sim:chip=AT29C010. Default is " DEFAULT_PORT ".\n"
+                    "  -n, --no-replay       only print statistics of the trace\n"
+                    "  -h, --help            print this message\n"
+                    "\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *port = DEFAULT_PORT;
+    bool replay = true;
+
+    while (true)
+    {
+        static struct option long_options[] =
+        {
+            { "port",           required_argument,  0, 'p' },
+            { "no-replay",      no_argument,        0, 'n' },
+            { "help",           no_argument,        0, 'h' },
+            { 0,                0,                  0, 0 }
+        };
+
+        int c = getopt_long(argc, argv, "p:nh", long_options, NULL);
+
+        if (c == -1)
+        {
+            break;
+        }
+
+        switch (c)
+        {
+        case 'p':
+            port = optarg;
+            break;
+
+        case 'n':
+            replay = false;
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    const char *path = argv[optind];
+    FILE *f = fopen(path, "r");
+    struct trace_header hdr;
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.record_size != sizeof(struct trace_record))
+    {
+        fprintf(stderr, "%s: Not a trace\n", path);
+        exit(1);
+    }
+
+    hdr.port[sizeof(hdr.port) - 1] = 0;
+
+    pp_t pp;
+
+    memset(&pp, 0, sizeof(pp));
+
+    if (replay && (pp_open(&pp, port) == -1 || pp.type != PP_SIM))
+    {
+        fprintf(stderr, "%s: Not a simulated port\n", port);
+        exit(1);
+    }
+
+    struct trace_record *buf = malloc(READ_RECORDS * sizeof(*buf));
+
+    if (buf == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    uint64_t base = replay ? pp_time(&pp) : 0;
+    uint64_t t = 0, phase_start = 0, last_op = 0, page_start = 0, page_worst = 0;
+    unsigned long records = 0, pages = 0, pages_missed = 0, flushes = 0;
+    bool gap_valid = false, in_page = false;
+    int phase = 0;
+    size_t count;
+
+    while ((count = fread(buf, sizeof(*buf), READ_RECORDS, f)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const struct trace_record *r = &buf[i];
+            struct phase_stats *ps = &stats[phase];
+
+            t += r->delta;
+            records++;
+
+            switch (r->op)
+            {
+            case TRACE_WDATA:
+            case TRACE_WCONTROL:
+            case TRACE_RSTATUS:
+                ps->ops++;
+
+                /* Gaps after a buffer flush are not latency, a delay in between counts */
+                if (gap_valid)
+                {
+                    add_histogram(ps, t - last_op);
+
+                    if (in_page && t - last_op > page_worst)
+                    {
+                        page_worst = t - last_op;
+                    }
+                }
+
+                last_op = t;
+                gap_valid = true;
+
+                if (!replay)
+                {
+                    break;
+                }
+
+                /* Accesses are stamped when done, start this one so that it ends on time */
+                if (base + t > pp_time(&pp))
+                {
+                    pp_ndelay(&pp, base + t - pp_time(&pp));
+                }
+
+                if (r->op == TRACE_WDATA)
+                {
+                    pp_wdata(&pp, r->value);
+                }
+                else if (r->op == TRACE_WCONTROL)
+                {
+                    pp_wcontrol(&pp, r->value);
+                }
+                else if (((pp_rstatus(&pp) ^ r->value) & STATUS_MASK) != 0)
+                {
+                    ps->mismatches++;
+                }
+
+                break;
+
+            case TRACE_DELAY:
+                ps->delay_us += r->arg;
+                break;
+
+            case TRACE_FLUSH:
+                flushes++;
+                gap_valid = false;
+                break;
+
+            case TRACE_PHASE:
+                if (r->value < TRACE_PHASES)
+                {
+                    ps->time_ns += t - phase_start;
+                    phase_start = t;
+                    phase = r->value;
+                }
+                break;
+
+            case TRACE_PROGRESS:
+                ps->kb++;
+                break;
+
+            case TRACE_PAGE_START:
+                in_page = true;
+                page_start = t;
+                page_worst = 0;
+                break;
+
+            case TRACE_PAGE_END:
+                in_page = false;
+                pages++;
+
+                if (page_worst > TBLC_LOAD_USEC * 1000ULL)
+                {
+                    pages_missed++;
+                }
+
+                add_gap(page_worst, page_start, phase);
+                break;
+            }
+        }
+    }
+
+    if (ferror(f))
+    {
+        perror(path);
+        exit(1);
+    }
+
+    fclose(f);
+    free(buf);
+
+    stats[phase].time_ns += t - phase_start;
+
+    printf("Trace of %s, %lu records, %.6f s, %lu buffer flushes during blocks\n\n", hdr.port, records, t / 1e9, flushes);
+    printf("%-12s %10s %10s %8s %9s %10s %10s\n", "phase", "time s", "ops", "kB", "ops/byte", "delays s", replay ? "mismatches" : "");
+
+    for (int i = 0; trace_phases[i] != NULL; i++)
+    {
+        const struct phase_stats *ps = &stats[i];
+
+        if (ps->ops == 0 && ps->time_ns == 0)
+        {
+            continue;
+        }
+
+        printf("%-12s %10.6f %10lu %8lu ", trace_phases[i], ps->time_ns / 1e9, ps->ops, ps->kb);
+
+        if (ps->kb > 0)
+        {
+            printf("%9.1f ", ps->ops / (ps->kb * 1024.0));
+        }
+        else
+        {
+            printf("%9s ", "-");
+        }
+
+        printf("%10.6f", ps->delay_us / 1e6);
+
+        if (replay)
+        {
+            printf(" %10lu", ps->mismatches);
+        }
+
+        printf("\n");
+    }
+
+    for (int i = 0; trace_phases[i] != NULL; i++)
+    {
+        if (stats[i].ops > 0)
+        {
+            printf("\nTime between accesses, %s:\n", trace_phases[i]);
+            print_histogram(&stats[i]);
+        }
+    }
+
+    if (pages > 0)
+    {
+        printf("\nPage loads: %lu, longest gap over %d us: %lu\n", pages, TBLC_LOAD_USEC, pages_missed);
+        printf("Longest gaps inside page loads:\n");
+
+        for (int i = 0; i < LONGEST_GAPS && longest[i].gap_ns > 0; i++)
+        {
+            printf("  %10.1f us  %-12s page load at %.6f s\n", longest[i].gap_ns / 1000.0, trace_phases[longest[i].phase], longest[i].at_ns / 1e9);
+        }
+    }
+
+    if (replay)
+    {
+        fflush(stdout);
+        pp_close(&pp);
+    }
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Run report in JSON for collecting statistics of many runs. Times of a
+ * simulated board are simulated as well, except for the wall time.
+ */
+
+#include "report.h"
+
+#include <string.h>
+
+static void json_string(FILE *f, const char *str)
+{
+    if (str == NULL)
+    {
+        fputs("null", f);
+        return;
+    }
+
+    fputc('"', f);
+
+    for (; *str != 0; str++)
+    {
+        unsigned char ch = *str;
+
+        if (ch == '"' || ch == '\\')
+        {
+            fprintf(f, "\\%c", ch);
+        }
+        else if (ch == '\n' && str[1] == 0)
+        {
+            /* Messages end with a newline, the report doesn't need it */
+        }
+        else if (ch < 0x20)
+        {
+            fprintf(f, "\\u%04x", ch);
+        }
+        else
+        {
+            fputc(ch, f);
+        }
+    }
+
+    fputc('"', f);
+}
+
+static void json_phase(FILE *f, const struct willem_phase_stats *st)
+{
+    double time_s = st->time_ns / 1e9;
+
+    fprintf(f, "{ \"time_s\": %.6f, \"bytes\": %llu, \"bytes_per_s\": %.0f, \"port_ops\": %lu, "
+               "\"address_shifts\": %lu, \"status_polls\": %lu, \"sleep_requested_s\": %.6f, \"sleep_actual_s\": %.6f }",
+            time_s, (unsigned long long) st->bytes, (time_s > 0) ? st->bytes / time_s : 0.0, st->port_ops,
+            st->addr_shifts, st->status_polls, st->delay_requested_ns / 1e9, st->delay_actual_ns / 1e9);
+}
+
+static void json_histogram(FILE *f, const struct willem_histogram *h)
+{
+    bool first = true;
+
+    fprintf(f, "{ \"unit_bytes\": %u, \"count\": %lu, \"min_us\": %.1f, \"mean_us\": %.1f, \"max_us\": %.1f, \"histogram\": [",
+            h->unit, h->count, h->min_ns / 1e3, (h->count > 0) ? h->total_ns / 1e3 / h->count : 0.0, h->max_ns / 1e3);
+
+    for (int i = 0; i < WILLEM_HISTOGRAM_BUCKETS; i++)
+    {
+        if (h->buckets[i] == 0)
+        {
+            continue;
+        }
+
+        fprintf(f, "%s { \"below_us\": ", first ? "" : ",");
+
+        if (i < WILLEM_HISTOGRAM_BUCKETS - 1)
+        {
+            fprintf(f, "%lu", 1UL << i);
+        }
+        else
+        {
+            fputs("null", f);
+        }
+
+        fprintf(f, ", \"count\": %lu }", h->buckets[i]);
+        first = false;
+    }
+
+    fputs(" ] }", f);
+}
+
+void report_begin(FILE *f, double wall_s)
+{
+    fprintf(f, "{\n  \"version\": 1,\n  \"wall_s\": %.3f,\n  \"boards\": [", wall_s);
+}
+
+/* Adds a board, result is the return value of the last run */
+void report_session(FILE *f, const struct willem_session *s, int result, bool first)
+{
+    struct willem_phase_stats total;
+
+    fprintf(f, "%s\n    {\n      \"port\": ", first ? "" : ",");
+    json_string(f, s->port);
+    fputs(",\n      \"chip\": ", f);
+    json_string(f, (s->cc != NULL) ? s->cc->name : NULL);
+
+    if (s->chip_id != 0)
+    {
+        fprintf(f, ",\n      \"chip_id\": \"0x%04x\"", s->chip_id);
+    }
+
+    fprintf(f, ",\n      \"result\": \"%s\"", (result != 0) ? "fail" : (s->terminate ? "interrupted" : "pass"));
+    fputs(",\n      \"error\": ", f);
+    json_string(f, (result != 0 && s->error[0] != 0) ? s->error : NULL);
+    fputs(",\n      \"access_paths\": ", f);
+    json_string(f, (s->bus.ops != NULL) ? s->bus.ops->name : NULL);
+
+    willem_phase_totals(s, &total);
+    fputs(",\n      \"total\": ", f);
+    json_phase(f, &total);
+
+    fputs(",\n      \"phases\": {", f);
+
+    for (int i = 0, n = 0; i < WILLEM_PHASES; i++)
+    {
+        const struct willem_phase_stats *st = &s->phase_stats[i];
+
+        if (st->time_ns == 0 && st->port_ops == 0)
+        {
+            continue;
+        }
+
+        fprintf(f, "%s\n        \"%s\": ", (n++ > 0) ? "," : "", willem_phase_names[i]);
+        json_phase(f, st);
+    }
+
+    fputs("\n      }", f);
+
+    fprintf(f, ",\n      \"delays\": { \"count\": %lu, \"worst_overshoot_us\": %.1f }", s->pp.delays.count, s->pp.delays.max_over_ns / 1e3);
+    fprintf(f, ",\n      \"critical_sections\": { \"count\": %lu, \"overruns\": %lu, \"worst_overrun_us\": %.1f }",
+            s->rt_stats.sections, s->rt_stats.overruns, s->rt_stats.worst_over_ns / 1e3);
+    fprintf(f, ",\n      \"pages_retried\": %lu", s->pages_retried);
+    fprintf(f, ",\n      \"control_mismatches\": %lu", s->pp.control_mismatches);
+
+    if (s->eprom_bytes > 0)
+    {
+        fprintf(f, ",\n      \"eprom_pulses\": %lu, \"eprom_bytes\": %lu", s->eprom_pulses, s->eprom_bytes);
+    }
+
+    fputs(",\n      \"program_time\": ", f);
+    json_histogram(f, &s->program_hist);
+    fputs("\n    }", f);
+}
+
+/* Returns 0 if everything has been written, -1 with errno set otherwise */
+int report_end(FILE *f)
+{
+    fputs("\n  ]\n}\n", f);
+
+    return (fflush(f) == EOF || ferror(f)) ? -1 : 0;
+}
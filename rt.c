@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rt.h"
+#include "delay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PREFAULT_STACK (256 * 1024)
+
+static void prefault_stack(void)
+{
+    volatile unsigned char stack[PREFAULT_STACK];
+
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+    {
+        stack[i] = 0;
+    }
+}
+
+static int pin(int cpu, bool verbose)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    /* Affects the calling thread only */
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        if (verbose)
+        {
+            perror("Warning: sched_setaffinity");
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Sets up scheduling policy, CPU affinity and memory locking. Every step is
+ * attempted even if a previous one failed. Returns 0 if all of them
+ * succeeded, -1 otherwise.
+ */
+int rt_setup(const struct rt_config *rc)
+{
+    struct sched_param p;
+    int res = 0;
+
+    memset(&p, 0, sizeof(p));
+    p.sched_priority = (rc->policy == SCHED_OTHER) ? 0 : rc->priority;
+
+    if (sched_setscheduler(0, rc->policy, &p) == -1)
+    {
+        if (rc->verbose)
+        {
+            perror("Warning: sched_setscheduler");
+        }
+        res = -1;
+    }
+
+    if (rc->cpu != -1 && pin(rc->cpu, rc->verbose) == -1)
+    {
+        res = -1;
+    }
+
+    if (rc->lock)
+    {
+        /* Keep freed memory and large buffers on the locked heap */
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+        {
+            if (rc->verbose)
+            {
+                perror("Warning: mlockall");
+            }
+            res = -1;
+        }
+
+        prefault_stack();
+    }
+
+    return res;
+}
+
+/*
+ * Completes the setup for a worker thread started after rt_setup(), which
+ * inherits the scheduling policy and memory locking but needs its own CPU
+ * and stack. Returns 0 on success, -1 otherwise.
+ */
+int rt_thread_setup(const struct rt_config *rc, int cpu)
+{
+    int res = 0;
+
+    if (cpu != -1 && pin(cpu, rc->verbose) == -1)
+    {
+        res = -1;
+    }
+
+    if (rc->lock)
+    {
+        prefault_stack();
+    }
+
+    return res;
+}
+
+void rt_prefault(void *buf, size_t len)
+{
+    volatile unsigned char *ptr = buf;
+    long page = sysconf(_SC_PAGESIZE);
+
+    for (size_t i = 0; i < len; i += page)
+    {
+        ptr[i] = ptr[i];
+    }
+}
+
+/*
+ * Measures how late timed wakeups are and the longest stretch of time the
+ * process was not running while busy-waiting, each for half of msec.
+ */
+void rt_latency_test(struct rt_latency *lat, unsigned int msec)
+{
+    uint64_t end = delay_now() + msec * 500000ULL;
+
+    memset(lat, 0, sizeof(*lat));
+
+    while (delay_now() < end)
+    {
+        uint64_t deadline = delay_now() + 200000;
+        struct timespec ts = { deadline / 1000000000ULL, deadline % 1000000000ULL };
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        {
+        }
+
+        uint64_t late = delay_now() - deadline;
+
+        if (late > lat->worst_wakeup_ns)
+        {
+            lat->worst_wakeup_ns = late;
+        }
+    }
+
+    uint64_t prev = delay_now();
+
+    end = prev + msec * 500000ULL;
+
+    while (prev < end)
+    {
+        uint64_t now = delay_now();
+
+        if (now - prev > lat->worst_gap_ns)
+        {
+            lat->worst_gap_ns = now - prev;
+        }
+
+        prev = now;
+    }
+}
+
+void rt_account(struct rt_stats *st, uint64_t elapsed_ns, uint64_t budget_ns)
+{
+    st->sections++;
+
+    if (elapsed_ns > budget_ns)
+    {
+        st->overruns++;
+
+        if (elapsed_ns - budget_ns > st->worst_over_ns)
+        {
+            st->worst_over_ns = elapsed_ns - budget_ns;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RT_H
+#define RT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct rt_config
+{
+    int policy;                         /* SCHED_RR, SCHED_FIFO or SCHED_OTHER */
+    int priority;                       /* Real-time priority */
+    int cpu;                            /* CPU to run on or -1 */
+    bool lock;                          /* Lock and prefault memory */
+    bool verbose;                       /* Report failures */
+};
+
+struct rt_stats
+{
+    unsigned long sections;             /* Critical sections executed */
+    unsigned long overruns;             /* Critical sections that overran their deadline */
+    uint64_t worst_over_ns;             /* Worst overrun */
+};
+
+struct rt_latency
+{
+    uint64_t worst_wakeup_ns;           /* Worst lateness of a timed wakeup */
+    uint64_t worst_gap_ns;              /* Worst gap seen while busy-waiting */
+};
+
+int rt_setup(const struct rt_config *rc);
+int rt_thread_setup(const struct rt_config *rc, int cpu);
+void rt_prefault(void *buf, size_t len);
+void rt_latency_test(struct rt_latency *lat, unsigned int msec);
+void rt_account(struct rt_stats *st, uint64_t elapsed_ns, uint64_t budget_ns);
+
+#endif /* RT_H */
@@ -0,0 +1,927 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Simulated WillemProg 3.0 board. Models the parts of the board that the
+ * programmer talks to:
+ *
+ * - 24-bit address shift register, clocked by D0 and fed from D1. The clock
+ *   only reaches the register while S6 is low, otherwise writing chip data
+ *   would shift the address.
+ * - 8-bit parallel-to-serial readback register. D1 selects parallel load,
+ *   D2 is the inverted clock and the MSB is presented inverted on ACK.
+ * - VCC (INIT), VPP (STROBE), S4 (SELECT) and S6 (inverted AUTOFD) lines.
+ *   S6 high drives the data lines to the chip, S6 low enables its outputs.
+ *   S4 is /WE for flash memories and /CE for EPROMs.
+ * - A chip: JEDEC flash with byte or page (AT29C) programming, or an EPROM
+ *   programmed with VPP pulses.
+ *
+ * Every port access costs a configurable amount of simulated time, delays
+ * requested via sim_ndelay() are simulated too, so the board "runs" as fast
+ * as the host can execute it.
+ */
+
+#include "sim.h"
+
+#include <linux/parport.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SIM_ADDR_MASK 0xffffff
+#define SIM_DEFAULT_COST_NSEC 1000
+#define SIM_TBLC_NSEC 150000ULL         /* AT29C byte load cycle time */
+#define SIM_STALL_NSEC 500000ULL        /* Host preemption modelled by stall= */
+
+enum sim_chip_type
+{
+    SIM_EPROM,
+    SIM_FLASH
+};
+
+#define SIM_ERASABLE 1                  /* EPROM erased by a long VPP pulse */
+#define SIM_BYPASS 2                    /* Flash with unlock bypass */
+
+/* Run of equally sized erase sectors, a zero size ends the list */
+struct sim_sectors
+{
+    uint32_t size;
+    unsigned int count;
+};
+
+struct sim_chip
+{
+    const char *name;
+    enum sim_chip_type type;
+    uint16_t id;                        /* Chip id or 0 for EPROMs */
+    uint32_t size;                      /* Size in bytes */
+    uint32_t page_size;                 /* AT29C page size or 0 if byte-programmed */
+    unsigned int flags;
+    unsigned int program_usec;          /* Typical byte/page program time or EPROM pulse width */
+    unsigned int erase_msec;            /* Typical chip erase time or EPROM erase pulse width */
+    const struct sim_sectors *sectors;  /* Erase sectors or NULL if only chip erase is supported */
+    unsigned int sector_erase_msec;     /* Typical sector erase time */
+};
+
+#define K(x) ((x) * 1024)
+static const struct sim_sectors uniform_64k[] = { { K(64), 8 }, { 0, 0 } };
+static const struct sim_sectors w49f002a_sectors[] = { { K(128), 1 }, { K(96), 1 }, { K(8), 2 }, { K(16), 1 }, { 0, 0 } };
+
+static const struct sim_chip sim_chips[] =
+{
+    { "27C512",     SIM_EPROM, 0,      K(64),  0,   0,            100, 0 },
+    { "W27C512",    SIM_EPROM, 0xda08, K(64),  0,   SIM_ERASABLE, 100, 100 },
+    { "27C010",     SIM_EPROM, 0,      K(128), 0,   0,            100, 0 },
+    { "27C020",     SIM_EPROM, 0,      K(256), 0,   0,            100, 0 },
+    { "27C040",     SIM_EPROM, 0,      K(512), 0,   0,            100, 0 },
+    { "27C080",     SIM_EPROM, 0,      K(1024), 0,  0,            100, 0 },
+
+    { "W49F002A",   SIM_FLASH, 0xda0b, K(256), 0,   0,            35, 100, w49f002a_sectors, 25 },
+    { "Am29F040",   SIM_FLASH, 0x01a4, K(512), 0,   0,            7, 8000, uniform_64k, 1000 },
+    { "Am29LV040B", SIM_FLASH, 0x014f, K(512), 0,   SIM_BYPASS,   9, 8000, uniform_64k, 700 },
+
+    { "AT29C512",   SIM_FLASH, 0x1f5d, K(32),  128, 0,            5000, 20 },
+    { "AT29C010",   SIM_FLASH, 0x1fd5, K(128), 128, 0,            5000, 20 },
+    { "AT29C020",   SIM_FLASH, 0x1fda, K(256), 256, 0,            5000, 20 },
+    { "AT29C040",   SIM_FLASH, 0x1f5b, K(512), 512, 0,            5000, 20 },
+    { "AT29C040A",  SIM_FLASH, 0x1fa4, K(512), 256, 0,            5000, 20 },
+    { "AT29LV040",  SIM_FLASH, 0x1f3b, K(512), 512, 0,            5000, 20 },
+    { "AT29LV040A", SIM_FLASH, 0x1fc4, K(512), 256, 0,            5000, 20 },
+};
+#undef K
+
+struct sim
+{
+    struct sim_chip chip;
+    uint8_t *mem;
+    uint16_t *charge;                   /* EPROM: accumulated pulse time per cell in usec */
+    unsigned int weak;                  /* Every n-th cell needs extra EPROM pulses or fails flash programming */
+    char *save;
+
+    uint64_t cost;                      /* Cost of a port access in nanoseconds */
+    uint64_t settle;                    /* Signals sampled sooner after a change see the old level */
+    unsigned long stall;                /* One in n port accesses is preempted */
+    uint32_t stall_seed;
+    uint64_t now;                       /* Simulated time in nanoseconds */
+
+    /* Port */
+    uint8_t data;
+    uint8_t control;
+
+    /* Last change of the data register and of D1 alone, with the level before */
+    uint64_t data_time;
+    uint8_t data_prev;
+    uint64_t d1_time;
+    uint8_t d1_prev;
+
+    /* Board */
+    uint32_t areg;
+    uint64_t areg_time;
+    uint8_t qreg;
+    uint64_t qreg_time;
+    uint8_t ack_prev;
+    uint64_t s4_fall;
+
+    /* Flash state machine */
+    int step;
+    bool erase_setup;
+    bool program;
+    bool autoselect;
+    bool bypass;
+    bool bypass_reset;
+    bool failed;                        /* Program exceeded timing limits, status shown until reset */
+    uint64_t busy_until;
+    uint32_t busy_addr;
+    uint8_t toggle;
+
+    /* AT29C page load */
+    bool loading;
+    uint32_t load_page;
+    uint64_t last_load;
+    uint32_t last_load_addr;
+    uint8_t *load_buf;
+
+    /* Statistics */
+    unsigned long long wdata, wcontrol, rcontrol, rstatus, rdata;
+    unsigned long long violations;
+};
+
+static bool vcc(const struct sim *s)
+{
+    return (s->control & PARPORT_CONTROL_INIT) != 0;
+}
+
+static bool vpp(const struct sim *s)
+{
+    return (s->control & PARPORT_CONTROL_STROBE) != 0;
+}
+
+static bool s4(const struct sim *s)
+{
+    return (s->control & PARPORT_CONTROL_SELECT) != 0;
+}
+
+static bool s6(const struct sim *s)
+{
+    return (s->control & PARPORT_CONTROL_AUTOFD) == 0;
+}
+
+static bool addr_clk(const struct sim *s)
+{
+    return (s->data & 1) && !s6(s);
+}
+
+/* Too little time has passed since a change at when for it to be seen */
+static bool unsettled(const struct sim *s, uint64_t when)
+{
+    return s->settle > 0 && s->now - when < s->settle;
+}
+
+static uint32_t chip_addr(const struct sim *s)
+{
+    /* Address lines above the chip size are not connected */
+    return s->areg % s->chip.size;
+}
+
+static void page_commit(struct sim *s)
+{
+    uint32_t base = s->load_page * s->chip.page_size;
+
+    memcpy(s->mem + base, s->load_buf, s->chip.page_size);
+    s->loading = false;
+    s->busy_until = s->last_load + SIM_TBLC_NSEC + s->chip.program_usec * 1000ULL;
+    s->busy_addr = s->last_load_addr;
+}
+
+static void advance(struct sim *s, uint64_t nsec)
+{
+    s->now += nsec;
+
+    if (s->loading && s->now - s->last_load > SIM_TBLC_NSEC)
+    {
+        page_commit(s);
+    }
+}
+
+static bool busy(const struct sim *s)
+{
+    return s->now < s->busy_until;
+}
+
+static bool weak_cell(const struct sim *s, uint32_t addr)
+{
+    return s->weak && (addr * 2654435761U) % s->weak == 0;
+}
+
+static void flash_program(struct sim *s, uint32_t addr, uint8_t value)
+{
+    s->program = false;
+
+    if (s->chip.page_size > 0)
+    {
+        uint32_t page = addr / s->chip.page_size;
+
+        if (!s->loading)
+        {
+            s->loading = true;
+            s->load_page = page;
+            /* Bytes not loaded are erased by the page write */
+            memset(s->load_buf, 0xff, s->chip.page_size);
+        }
+        else if (page != s->load_page)
+        {
+            s->violations++;
+            return;
+        }
+
+        s->load_buf[addr % s->chip.page_size] = value;
+        s->last_load = s->now;
+        s->last_load_addr = addr;
+        return;
+    }
+
+    s->busy_until = s->now + s->chip.program_usec * 1000ULL;
+    s->busy_addr = addr;
+
+    /* Times out, the status with DQ5 set is read until a reset */
+    if (weak_cell(s, addr))
+    {
+        s->failed = true;
+        s->busy_until = 0;
+        return;
+    }
+
+    s->mem[addr] &= value;
+}
+
+static void sector_erase(struct sim *s, uint32_t addr)
+{
+    uint32_t base = 0;
+
+    for (const struct sim_sectors *r = s->chip.sectors; r->size > 0; r++)
+    {
+        if (addr < base + r->size * r->count)
+        {
+            uint32_t start = base + (addr - base) / r->size * r->size;
+
+            if (start + r->size > s->chip.size)
+            {
+                break;
+            }
+
+            memset(s->mem + start, 0xff, r->size);
+            s->busy_until = s->now + s->chip.sector_erase_msec * 1000000ULL;
+            s->busy_addr = start;
+            return;
+        }
+
+        base += r->size * r->count;
+    }
+
+    s->violations++;
+}
+
+static void flash_cycle(struct sim *s, uint32_t addr, uint8_t value)
+{
+    uint32_t cmd_addr = s->areg & 0x7fff;
+
+    if (busy(s))
+    {
+        s->violations++;
+        return;
+    }
+
+    /* Only reset leaves a failed program, in or out of unlock bypass */
+    if (s->failed)
+    {
+        if (value == 0xf0)
+        {
+            s->failed = false;
+            return;
+        }
+
+        s->violations++;
+        return;
+    }
+
+    /* Subsequent bytes of an AT29C page load need no command */
+    if (s->loading || s->program)
+    {
+        flash_program(s, addr, value);
+        return;
+    }
+
+    /* Unlock bypass accepts only two-cycle program and reset, at any address */
+    if (s->bypass)
+    {
+        if (s->bypass_reset)
+        {
+            s->bypass_reset = false;
+
+            if (value == 0x00)
+            {
+                s->bypass = false;
+                return;
+            }
+        }
+        else if (value == 0xa0)
+        {
+            s->program = true;
+            return;
+        }
+        else if (value == 0x90)
+        {
+            s->bypass_reset = true;
+            return;
+        }
+
+        s->violations++;
+        return;
+    }
+
+    if (value == 0xf0 && s->step == 0)
+    {
+        s->autoselect = false;
+        s->erase_setup = false;
+        return;
+    }
+
+    switch (s->step)
+    {
+    case 0:
+        if (cmd_addr == 0x5555 && value == 0xaa)
+        {
+            s->step = 1;
+            return;
+        }
+        break;
+
+    case 1:
+        if (cmd_addr == 0x2aaa && value == 0x55)
+        {
+            s->step = 2;
+            return;
+        }
+        break;
+
+    case 2:
+        s->step = 0;
+
+        if (s->erase_setup)
+        {
+            s->erase_setup = false;
+
+            if (cmd_addr == 0x5555 && value == 0x10)
+            {
+                memset(s->mem, 0xff, s->chip.size);
+                s->busy_until = s->now + s->chip.erase_msec * 1000000ULL;
+                s->busy_addr = 0;
+                return;
+            }
+
+            if (value == 0x30 && s->chip.sectors != NULL)
+            {
+                sector_erase(s, addr);
+                return;
+            }
+            break;
+        }
+
+        if (cmd_addr != 0x5555)
+        {
+            break;
+        }
+
+        switch (value)
+        {
+        case 0x90:
+            s->autoselect = true;
+            return;
+
+        case 0xf0:
+            s->autoselect = false;
+            return;
+
+        case 0xa0:
+            s->program = true;
+            return;
+
+        case 0x80:
+            s->erase_setup = true;
+            return;
+
+        case 0x20:
+            if (s->chip.flags & SIM_BYPASS)
+            {
+                s->bypass = true;
+                return;
+            }
+            break;
+        }
+        break;
+    }
+
+    s->step = 0;
+    s->violations++;
+}
+
+static void eprom_pulse(struct sim *s, uint32_t addr, uint8_t value, uint64_t nsec)
+{
+    if ((s->chip.flags & SIM_ERASABLE) && nsec >= s->chip.erase_msec * 1000000ULL)
+    {
+        memset(s->mem, 0xff, s->chip.size);
+        memset(s->charge, 0, s->chip.size * sizeof(s->charge[0]));
+        return;
+    }
+
+    unsigned int need = s->chip.program_usec;
+
+    if (weak_cell(s, addr))
+    {
+        need *= 2 + (addr >> 3) % 3;
+    }
+
+    unsigned int charge = s->charge[addr] + nsec / 1000;
+
+    if (charge >= need)
+    {
+        s->mem[addr] &= value;
+        charge = 0;
+    }
+
+    s->charge[addr] = (charge > UINT16_MAX) ? UINT16_MAX : charge;
+}
+
+static const struct sim_chip *find_chip(const char *name)
+{
+    for (int i = 0; i < sizeof(sim_chips) / sizeof(sim_chips[0]); ++i)
+    {
+        if (strcasecmp(name, sim_chips[i].name) == 0)
+        {
+            return &sim_chips[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t chip_output(struct sim *s)
+{
+    uint32_t addr = chip_addr(s);
+
+    if (!vcc(s))
+    {
+        return 0xff;
+    }
+
+    if (s->chip.type == SIM_EPROM)
+    {
+        return s4(s) ? 0xff : s->mem[addr];
+    }
+
+    if (!s4(s))
+    {
+        return 0xff;
+    }
+
+    /* Reading during a page load starts the write cycle */
+    if (s->loading)
+    {
+        page_commit(s);
+    }
+
+    if (busy(s))
+    {
+        s->toggle ^= 0x40;
+        return (~s->mem[s->busy_addr] & 0x80) | s->toggle;
+    }
+
+    if (s->failed)
+    {
+        s->toggle ^= 0x40;
+        return (~s->mem[s->busy_addr] & 0x80) | s->toggle | 0x20;
+    }
+
+    if (s->autoselect)
+    {
+        switch (addr & 0xff)
+        {
+        case 0:
+            return s->chip.id >> 8;
+        case 1:
+            return s->chip.id & 0xff;
+        default:
+            return 0x00;
+        }
+    }
+
+    return s->mem[addr];
+}
+
+static void strobe(struct sim *s)
+{
+    if (!vcc(s) || !s6(s))
+    {
+        return;
+    }
+
+    /* Data has to be set up before the strobe starts */
+    uint8_t data = (s->settle > 0 && s->s4_fall - s->data_time < s->settle) ? s->data_prev : s->data;
+
+    if (s->chip.type == SIM_FLASH)
+    {
+        flash_cycle(s, chip_addr(s), data);
+    }
+    else if (vpp(s))
+    {
+        eprom_pulse(s, chip_addr(s), data, s->now - s->s4_fall);
+    }
+}
+
+static void board_update(struct sim *s, uint8_t old_data, uint8_t old_control)
+{
+    bool old_clk = (old_data & 1) && (old_control & PARPORT_CONTROL_AUTOFD);
+
+    if (!old_clk && addr_clk(s))
+    {
+        uint8_t d1 = unsettled(s, s->d1_time) ? s->d1_prev : s->data;
+
+        s->areg = ((s->areg << 1) | ((d1 >> 1) & 1)) & SIM_ADDR_MASK;
+        s->areg_time = s->now;
+    }
+
+    /* Readback register clock is inverted D2 */
+    if ((old_data & 4) && !(s->data & 4))
+    {
+        s->ack_prev = s->qreg & 0x80;
+        s->qreg_time = s->now;
+
+        if (s->data & 2)
+        {
+            s->qreg = s6(s) ? 0xff : chip_output(s);
+
+            /* Outputs still following the address or output enable */
+            if (unsettled(s, s->areg_time) || (!s4(s) && unsettled(s, s->s4_fall)))
+            {
+                s->qreg = ~s->qreg;
+            }
+        }
+        else
+        {
+            s->qreg <<= 1;
+        }
+    }
+
+    if ((old_control & PARPORT_CONTROL_INIT) != (s->control & PARPORT_CONTROL_INIT))
+    {
+        /* Power cycle resets the chip */
+        s->step = 0;
+        s->erase_setup = false;
+        s->program = false;
+        s->autoselect = false;
+        s->loading = false;
+        s->failed = false;
+        s->busy_until = 0;
+    }
+
+    if ((old_control & PARPORT_CONTROL_SELECT) && !s4(s))
+    {
+        s->s4_fall = s->now;
+    }
+
+    if (!(old_control & PARPORT_CONTROL_SELECT) && s4(s))
+    {
+        strobe(s);
+    }
+}
+
+static void port_access(struct sim *s)
+{
+    uint64_t cost = s->cost;
+
+    if (s->stall)
+    {
+        /* xorshift32, so stalls do not line up with retried sequences */
+        s->stall_seed ^= s->stall_seed << 13;
+        s->stall_seed ^= s->stall_seed >> 17;
+        s->stall_seed ^= s->stall_seed << 5;
+    }
+
+    if (s->stall && s->stall_seed % s->stall == 0)
+    {
+        cost += SIM_STALL_NSEC;
+    }
+
+    advance(s, cost);
+}
+
+int sim_rstatus(struct sim *s)
+{
+    s->rstatus++;
+    port_access(s);
+
+    uint8_t ack = unsettled(s, s->qreg_time) ? s->ack_prev : (s->qreg & 0x80);
+
+    return ack ? 0 : PARPORT_STATUS_ACK;
+}
+
+int sim_wcontrol(struct sim *s, unsigned char val)
+{
+    uint8_t old = s->control;
+
+    s->wcontrol++;
+    port_access(s);
+    s->control = val;
+    board_update(s, s->data, old);
+
+    return 0;
+}
+
+int sim_rcontrol(struct sim *s)
+{
+    s->rcontrol++;
+    port_access(s);
+
+    return s->control;
+}
+
+int sim_wdata(struct sim *s, unsigned char val)
+{
+    uint8_t old = s->data;
+
+    s->wdata++;
+    port_access(s);
+
+    if (val != old)
+    {
+        s->data_time = s->now;
+        s->data_prev = old;
+    }
+
+    if ((val ^ old) & 2)
+    {
+        s->d1_time = s->now;
+        s->d1_prev = old;
+    }
+
+    s->data = val;
+    board_update(s, old, s->control);
+
+    return 0;
+}
+
+int sim_rdata(struct sim *s)
+{
+    s->rdata++;
+    port_access(s);
+
+    return s->data;
+}
+
+void sim_ndelay(struct sim *s, uint64_t nsec)
+{
+    advance(s, nsec);
+}
+
+uint64_t sim_time(const struct sim *s)
+{
+    return s->now;
+}
+
+static unsigned long parse_size(const char *str)
+{
+    char *end = NULL;
+    unsigned long val = strtoul(str, &end, 0);
+
+    if (*end == 'K' || *end == 'k')
+    {
+        val *= 1024;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        val *= 1024 * 1024;
+    }
+
+    return val;
+}
+
+static int load_image(struct sim *s, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    ssize_t len = read(fd, s->mem, s->chip.size);
+
+    close(fd);
+
+    return (len == -1) ? -1 : 0;
+}
+
+struct sim *sim_open(const char *args)
+{
+    struct sim *s = calloc(1, sizeof(*s));
+
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    s->chip = *find_chip("Am29F040");
+    s->cost = SIM_DEFAULT_COST_NSEC;
+    s->control = PARPORT_CONTROL_SELECT;
+
+    char *opts = strdup((args != NULL) ? args : "");
+    const char *image = NULL;
+    uint32_t size = 0;
+    char *saveptr = NULL;
+
+    if (opts == NULL)
+    {
+        goto failure;
+    }
+
+    for (char *opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr))
+    {
+        char *val = strchr(opt, '=');
+
+        if (val == NULL)
+        {
+            goto failure;
+        }
+
+        *val++ = 0;
+
+        if (strcmp(opt, "chip") == 0)
+        {
+            const struct sim_chip *chip = find_chip(val);
+
+            if (chip == NULL)
+            {
+                goto failure;
+            }
+
+            s->chip = *chip;
+        }
+        else if (strcmp(opt, "cost") == 0)
+        {
+            s->cost = strtoull(val, NULL, 0);
+        }
+        else if (strcmp(opt, "settle") == 0)
+        {
+            s->settle = strtoull(val, NULL, 0);
+        }
+        else if (strcmp(opt, "size") == 0)
+        {
+            size = parse_size(val);
+        }
+        else if (strcmp(opt, "stall") == 0)
+        {
+            s->stall = strtoul(val, NULL, 0);
+            s->stall_seed = 2463534242U;
+        }
+        else if (strcmp(opt, "weak") == 0)
+        {
+            s->weak = strtoul(val, NULL, 0);
+        }
+        else if (strcmp(opt, "image") == 0)
+        {
+            image = val;
+        }
+        else if (strcmp(opt, "save") == 0)
+        {
+            free(s->save);
+            s->save = strdup(val);
+
+            if (s->save == NULL)
+            {
+                goto failure;
+            }
+        }
+        else
+        {
+            goto failure;
+        }
+    }
+
+    if (size > 0)
+    {
+        s->chip.size = (size > SIM_ADDR_MASK + 1) ? SIM_ADDR_MASK + 1 : size;
+    }
+
+    s->mem = malloc(s->chip.size);
+
+    if (s->mem == NULL)
+    {
+        goto failure;
+    }
+
+    memset(s->mem, 0xff, s->chip.size);
+
+    if (s->chip.type == SIM_EPROM)
+    {
+        s->charge = calloc(s->chip.size, sizeof(s->charge[0]));
+
+        if (s->charge == NULL)
+        {
+            goto failure;
+        }
+    }
+
+    if (s->chip.page_size > 0)
+    {
+        s->load_buf = malloc(s->chip.page_size);
+
+        if (s->load_buf == NULL)
+        {
+            goto failure;
+        }
+    }
+
+    if (image != NULL && load_image(s, image) == -1)
+    {
+        goto failure;
+    }
+
+    free(opts);
+
+    return s;
+
+failure:
+    free(opts);
+    free(s->load_buf);
+    free(s->charge);
+    free(s->mem);
+    free(s->save);
+    free(s);
+
+    return NULL;
+}
+
+void sim_close(struct sim *s)
+{
+    if (s->save != NULL)
+    {
+        int fd = open(s->save, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+
+        if (fd == -1 || write(fd, s->mem, s->chip.size) != s->chip.size)
+        {
+            perror(s->save);
+        }
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    unsigned long long ops = s->wdata + s->wcontrol + s->rcontrol + s->rstatus + s->rdata;
+
+    fprintf(stderr, "sim: %s, %llu ops (wdata %llu, wcontrol %llu, rcontrol %llu, rstatus %llu, rdata %llu), "
+                    "%llu violations, %llu.%06llu s simulated\n",
+                    s->chip.name, ops, s->wdata, s->wcontrol, s->rcontrol, s->rstatus, s->rdata,
+                    s->violations, (unsigned long long) s->now / 1000000000, (unsigned long long) (s->now / 1000) % 1000000);
+
+    free(s->load_buf);
+    free(s->charge);
+    free(s->mem);
+    free(s->save);
+    free(s);
+}
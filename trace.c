@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Phases named by the library, the last one stands for any other */
+const char *trace_phases[TRACE_PHASES + 1] = { "Setup", "Erasing", "Reading", "Blank check", "Checksum", "Writing", "Updating", "Verifying", "Other", NULL };
+
+/*
+ * Creates the trace file, now is the time the first record is relative to.
+ * Returns NULL on failure with errno set.
+ */
+struct trace *trace_open(const char *path, const char *port, uint64_t now)
+{
+    struct trace_header hdr;
+    struct trace *t = calloc(1, sizeof(*t));
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+
+    /* Touched right away, so that page faults don't show up in the trace */
+    t->buf = malloc(TRACE_RECORDS * sizeof(*t->buf));
+
+    if (t->buf == NULL)
+    {
+        free(t);
+        return NULL;
+    }
+
+    memset(t->buf, 0, TRACE_RECORDS * sizeof(*t->buf));
+
+    t->fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.record_size = sizeof(struct trace_record);
+    strncpy(hdr.port, port, sizeof(hdr.port) - 1);
+
+    if (t->fd == -1 || write(t->fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        int saved_errno = errno;
+
+        if (t->fd != -1)
+        {
+            close(t->fd);
+        }
+
+        free(t->buf);
+        free(t);
+        errno = saved_errno;
+
+        return NULL;
+    }
+
+    t->last = now;
+
+    return t;
+}
+
+/* Writes out the buffered records. Returns 0 or -1 with errno set. */
+int trace_flush(struct trace *t)
+{
+    const char *ptr = (const char *) t->buf;
+    size_t len = t->count * sizeof(*t->buf);
+
+    t->count = 0;
+
+    while (t->error == 0 && len > 0)
+    {
+        ssize_t res = write(t->fd, ptr, len);
+
+        if (res == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (res == -1)
+        {
+            t->error = errno;
+            break;
+        }
+
+        ptr += res;
+        len -= res;
+    }
+
+    if (t->error != 0)
+    {
+        errno = t->error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The buffer filled up in the middle of a block */
+void trace_overflow(struct trace *t)
+{
+    trace_flush(t);
+    t->flushes++;
+
+    t->buf[0] = (struct trace_record) { 0, TRACE_FLUSH, 0, 0 };
+    t->count = 1;
+}
+
+/*
+ * Records the phase and its progress (kb is -1 if there is none). Called
+ * between blocks, which is when the buffer is written out.
+ */
+void trace_phase(struct trace *t, uint64_t now, const char *phase, long kb)
+{
+    int id;
+
+    for (id = 0; id < TRACE_PHASES - 1; id++)
+    {
+        if (strcmp(trace_phases[id], phase) == 0)
+        {
+            break;
+        }
+    }
+
+    if (id != t->phase)
+    {
+        trace_add(t, now, TRACE_PHASE, id, 0);
+        t->phase = id;
+    }
+
+    if (kb >= 0)
+    {
+        trace_add(t, now, TRACE_PROGRESS, 0, kb);
+    }
+
+    if (t->count >= TRACE_RECORDS / 2)
+    {
+        trace_flush(t);
+    }
+}
+
+/* Writes out the rest and closes the file. Returns 0 or -1 with errno set. */
+int trace_close(struct trace *t)
+{
+    int res = trace_flush(t);
+
+    if (close(t->fd) == -1)
+    {
+        res = -1;
+    }
+
+    free(t->buf);
+    free(t);
+
+    return res;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Port operation trace. Records are kept in a preallocated buffer and
+ * written to the file at checkpoints between blocks, or when the buffer
+ * fills up, which is then recorded as TRACE_FLUSH.
+ */
+
+#define TRACE_MAGIC "W3TRACE1"
+#define TRACE_RECORDS (1 << 20)         /* Records buffered, 8 MB */
+#define TRACE_PHASES 9                  /* Names in trace_phases, the last one is "Other" */
+
+enum trace_op
+{
+    TRACE_WDATA = 1,                    /* Data register write, value */
+    TRACE_WCONTROL,                     /* Control register write, value */
+    TRACE_RSTATUS,                      /* Status register read, value read */
+    TRACE_DELAY,                        /* Delay, arg in microseconds, saturated */
+    TRACE_PHASE,                        /* Phase change, value from trace_phases */
+    TRACE_PROGRESS,                     /* Progress of a phase, arg in kB, saturated */
+    TRACE_PAGE_START,                   /* Page load started */
+    TRACE_PAGE_END,                     /* Page load finished */
+    TRACE_FLUSH,                        /* Buffer written out, the gap to the next access includes it */
+};
+
+struct trace_header
+{
+    char magic[8];                      /* TRACE_MAGIC */
+    uint32_t record_size;               /* sizeof(struct trace_record) */
+    uint32_t reserved;
+    char port[48];                      /* Port traced, for information */
+};
+
+struct trace_record
+{
+    uint32_t delta;                     /* Nanoseconds since the previous record, saturated */
+    uint8_t op;                         /* enum trace_op */
+    uint8_t value;
+    uint16_t arg;
+};
+
+struct trace
+{
+    int fd;
+    struct trace_record *buf;
+    size_t count;
+    uint64_t last;                      /* Time of the previous record */
+    uint8_t phase;                      /* Last phase recorded */
+    unsigned long flushes;              /* Writes forced by a full buffer */
+    int error;                          /* First write error */
+};
+
+extern const char *trace_phases[TRACE_PHASES + 1];
+
+struct trace *trace_open(const char *path, const char *port, uint64_t now);
+void trace_overflow(struct trace *t);
+void trace_phase(struct trace *t, uint64_t now, const char *phase, long kb);
+int trace_flush(struct trace *t);
+int trace_close(struct trace *t);
+
+/* Appends a record stamped after the operation, called for every port access */
+static inline void trace_add(struct trace *t, uint64_t now, int op, int value, unsigned long arg)
+{
+    struct trace_record *r = &t->buf[t->count++];
+    uint64_t delta = now - t->last;
+
+    r->delta = (delta > UINT32_MAX) ? UINT32_MAX : delta;
+    r->op = op;
+    r->value = value;
+    r->arg = (arg > UINT16_MAX) ? UINT16_MAX : arg;
+    t->last = now;
+
+    if (t->count == TRACE_RECORDS)
+    {
+        trace_overflow(t);
+    }
+}
+
+#endif /* TRACE_H */
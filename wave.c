@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wave.h"
+#include "pp.h"
+
+#include <string.h>
+
+/*
+ * Data register bits used by the board:
+ *
+ * D0 - address shift register clock (rising edge)
+ * D1 - address shift register data, readback register parallel load
+ * D2 - readback register clock (inverted)
+ */
+#define ADDR_CLK 1
+#define ADDR_D 2
+#define READ_PL 2
+#define READ_CLK_N 4
+
+/*
+ * Parallel load followed by serial readout of 8 bits, MSB first. Lowering
+ * address clock is merged into the first write and the last bit needs no
+ * clock afterwards.
+ */
+static const uint16_t read_ops[] =
+{
+    READ_PL | READ_CLK_N,   /* P/S=1, CLK=0 */
+    READ_PL,                /* P/S=1, CLK=1 */
+    READ_CLK_N,             /* P/S=0, CLK=0 */
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE, 0, READ_CLK_N,
+    PP_OP_SAMPLE
+};
+
+/*
+ * Shifts the address MSB first. Every bit takes two writes: data with clock
+ * low, which also ends the previous clock pulse, and data with clock high.
+ * The clock is left high after the last bit, the next write lowers it.
+ */
+void wave_address(wave_t *w, uint32_t addr, int bits)
+{
+    unsigned int len = 0;
+
+    for (int i = bits - 1; i >= 0; --i)
+    {
+        uint16_t data = (addr & (1 << i)) ? ADDR_D : 0;
+
+        w->ops[len++] = data;
+        w->ops[len++] = data | ADDR_CLK;
+    }
+
+    w->len = len;
+}
+
+void wave_read(wave_t *w)
+{
+    memcpy(w->ops + w->len, read_ops, sizeof(read_ops));
+    w->len += sizeof(read_ops) / sizeof(read_ops[0]);
+}
@@ -0,0 +1,2312 @@
+/*
+ * Copyright (c) 2022-2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "willem.h"
+#include "crc32.h"
+#include "wave.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+
+#define TBLC_USEC 200                   /* AT29C byte load window with margin */
+#define PAGE_RETRIES 3                  /* Reloads of a page after a missed byte load window */
+#define ERASE_POLL_USEC 1000            /* Status poll interval during erase */
+#define VPP_SETTLE_USEC 10              /* VPP switching time */
+#define FLASH_RESET_USEC 20             /* Return to reading data after reset */
+#define BLOCK_SIZE 1024                 /* Write and verify granularity */
+#define CALIBRATE_BYTES 4096            /* Read back at every calibration step */
+#define CALIBRATE_PASSES 2              /* Sequential and scattered */
+#define CALIBRATE_REGION 512            /* Bytes programmed by a write test, a whole AT29C page */
+#define CALIBRATE_MARGIN_PERCENT 100    /* Added to the shortest delay that worked */
+#define ESTIMATE_PROBE_OPS 1000         /* Status reads timed to measure the port access time */
+#define POWER_ON_USEC 100000            /* VCC settling after power up */
+
+#define K(x) ((x) * 1024)
+static const struct erase_region uniform_64k[] = { { K(64), 8 }, { 0, 0 } };
+
+/* Top boot block: two main blocks, two parameter blocks and the boot block */
+static const struct erase_region w49f002a_sectors[] = { { K(128), 1 }, { K(96), 1 }, { K(8), 2 }, { K(16), 1 }, { 0, 0 } };
+
+static struct chip_config chip_config[] =
+{
+    { 0xda08, K(64),  0, "W27C512", -1, -1, 16, "27512", 0, 0, 0, 0 },
+
+    { 0xda0b, K(256), 0, "W49F002A", 50, 1, 18, "29x0x0", 0, 0, 0, 0, w49f002a_sectors, 1, 35, 25 },
+
+    { 0x01a4, K(512), 0, "Am29F040", 300, 64, 19, "29x0x0", CHIP_DQ5, 0, 0, 0, uniform_64k, 8, 7, 1000 },
+    { 0x014f, K(512), 0, "Am29LV040B", 300, 64, 19, "29x0x0", CHIP_DQ5 | CHIP_UNLOCK_BYPASS, 0, 0, 0, uniform_64k, 8, 9, 700 },
+
+    { 0x1f5d, K(32), 128, "AT29C512", 10000, 20, 15, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1fd5, K(128), 128, "AT29C010", 10000, 20, 17, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1fda, K(256), 256, "AT29C020", 10000, 20, 18, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1f5b, K(512), 512, "AT29C040", 10000, 20, 19, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1fa4, K(512), 256, "AT29C040A", 10000, 20, 19, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1f3b, K(512), 512, "AT29LV040", 10000, 20, 19, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+    { 0x1fc4, K(512), 256, "AT29LV040A", 10000, 20, 19, "29x0x0", 0, 0, 0, 0, NULL, 0, 5000, 0 },
+
+    /* Intelligent programming: 1 ms pulses, overprogram with 3x the total */
+    { 0, K(8), 0, "2764", 0, 0, 13, "2764", CHIP_EPROM, 1000, 25, 3 },
+    { 0, K(16), 0, "27128", 0, 0, 14, "27128", CHIP_EPROM, 1000, 25, 3 },
+
+    /* Quick-pulse programming: 100 us pulses, no overprogram */
+    { 0, K(32), 0, "27C256", 0, 0, 15, "27256", CHIP_EPROM, 100, 25, 0 },
+    { 0, K(64), 0, "27C512", 0, 0, 16, "27512", CHIP_EPROM, 100, 25, 0 },
+    { 0, K(128), 0, "27C010", 0, 0, 17, "27C010", CHIP_EPROM, 100, 25, 0 },
+    { 0, K(256), 0, "27C020", 0, 0, 18, "27C020", CHIP_EPROM, 100, 25, 0 },
+    { 0, K(512), 0, "27C040", 0, 0, 19, "27040", CHIP_EPROM, 100, 25, 0 },
+    { 0, K(1024), 0, "27C080", 0, 0, 20, "27C080", CHIP_EPROM, 100, 25, 0 }
+};
+#undef K
+
+/* Pulse settings for EPROMs not selected with --chip */
+static const struct chip_config eprom_default =
+{
+    0, 0, 0, "EPROM", 0, 0, 24, NULL, CHIP_EPROM, 100, 25, 0
+};
+
+/*
+ * Lines above the address bits that reach a control pin are held high: VPP
+ * of 2716, 27256 and 27040 is where the next larger chip has A11, A15 and
+ * A19, /PGM of 2764, 27128, 27010 and 27020 where it has A14 and A18.
+ */
+static struct jumper_config jumper_config[] =
+{
+    { "2716",   11, 1 << 11, 1 << 11 },
+    { "2732",   12, 0, 0 },
+    { "2764",   13, 1 << 14, 1 << 14 },
+    { "27128",  14, 1 << 14, 1 << 14 },
+    { "27256",  15, 1 << 15, 1 << 15 },
+    { "27512",  16, 0, 0 },
+    { "27010",  17, 1 << 18, 1 << 18 },
+    { "27020",  18, 1 << 18, 1 << 18 },
+    { "27C010", 17, 1 << 18, 1 << 18 },
+    { "27C020", 18, 1 << 18, 1 << 18 },
+    { "27040",  19, 1 << 19, 1 << 19 },
+    { "27C080", 20, 0, 0 },
+    { "29x0x0", 19, 0, 0 }
+};
+
+const char *willem_phase_names[WILLEM_PHASES] = { "idle", "id", "erase", "blank_check", "read", "write", "verify" };
+
+static struct chip_config *find_chip(const char *name)
+{
+    for (int i = 0; i < sizeof(chip_config) / sizeof(chip_config[0]); ++i)
+    {
+        if (strcasecmp(name, chip_config[i].name) == 0)
+        {
+            return &chip_config[i];
+        }
+    }
+
+    return NULL;
+}
+
+struct jumper_config *willem_find_jumpers(const char *name)
+{
+    for (int i = 0; i < sizeof(jumper_config) / sizeof(jumper_config[0]); ++i)
+    {
+        if (strcasecmp(name, jumper_config[i].name) == 0)
+        {
+            return &jumper_config[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Progress of the current phase, the callback may ask to cancel */
+static void progress(struct willem_session *s, const char *phase, uint32_t kb)
+{
+    s->phase = phase;
+    s->progress_kb = kb;
+    pp_trace_phase(&s->pp, phase, kb);
+
+    if (s->cb.progress != NULL && s->cb.progress(s->cb.arg, phase, kb) != 0)
+    {
+        s->terminate = true;
+    }
+}
+
+/* Start of a phase without a byte count, e.g. chip erase */
+static void phase(struct willem_session *s, const char *phase)
+{
+    s->phase = phase;
+    s->progress_kb = 0;
+    pp_trace_phase(&s->pp, phase, -1);
+
+    if (s->cb.progress != NULL && s->cb.progress(s->cb.arg, phase, -1) != 0)
+    {
+        s->terminate = true;
+    }
+}
+
+static void info(struct willem_session *s, const char *fmt, ...)
+{
+    char text[256];
+    va_list ap;
+
+    if (s->cb.message == NULL)
+    {
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    s->cb.message(s->cb.arg, text);
+}
+
+/* Reports an error, the last one is kept in the session */
+static void fail(struct willem_session *s, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(s->error, sizeof(s->error), fmt, ap);
+    va_end(ap);
+
+    if (s->cb.error != NULL)
+    {
+        s->cb.error(s->cb.arg, s->error);
+    }
+}
+
+/* Counters the phases are charged with, running totals */
+static void stats_read(struct willem_session *s, struct willem_phase_stats *st)
+{
+    st->time_ns = pp_time(&s->pp);
+    st->port_ops = s->pp.ops;
+    st->addr_shifts = s->bus.addr_shifts;
+    st->status_polls = s->status_polls;
+    st->delay_requested_ns = s->pp.delays.requested_ns;
+    st->delay_actual_ns = s->pp.delays.actual_ns;
+}
+
+/* Charges the phase that is ending with what happened since it began */
+static void stats_enter(struct willem_session *s, enum willem_phase phase)
+{
+    struct willem_phase_stats now;
+    struct willem_phase_stats *st = &s->phase_stats[s->stats_phase];
+
+    stats_read(s, &now);
+
+    st->time_ns += now.time_ns - s->stats_mark.time_ns;
+    st->port_ops += now.port_ops - s->stats_mark.port_ops;
+    st->addr_shifts += now.addr_shifts - s->stats_mark.addr_shifts;
+    st->status_polls += now.status_polls - s->stats_mark.status_polls;
+    st->delay_requested_ns += now.delay_requested_ns - s->stats_mark.delay_requested_ns;
+    st->delay_actual_ns += now.delay_actual_ns - s->stats_mark.delay_actual_ns;
+
+    s->stats_mark = now;
+    s->stats_phase = phase;
+}
+
+static void stats_bytes(struct willem_session *s, uint32_t len)
+{
+    s->phase_stats[s->stats_phase].bytes += len;
+}
+
+static void program_histogram(struct willem_session *s, uint32_t unit, uint64_t ns)
+{
+    struct willem_histogram *h = &s->program_hist;
+    int i = 0;
+
+    while (i < WILLEM_HISTOGRAM_BUCKETS - 1 && ns >= (1000ULL << i))
+    {
+        i++;
+    }
+
+    h->buckets[i]++;
+    h->min_ns = (h->count == 0 || ns < h->min_ns) ? ns : h->min_ns;
+    h->max_ns = (ns > h->max_ns) ? ns : h->max_ns;
+    h->total_ns += ns;
+    h->count++;
+    h->unit = unit;
+}
+
+/*
+ * Adds time spent programming part of the sector at the given address.
+ * Sectors are written in order, so a new one means the last one is done.
+ */
+static void program_time(struct willem_session *s, uint32_t sector, uint32_t unit, uint64_t ns)
+{
+    if (sector != s->program_sector && s->program_ns > 0)
+    {
+        program_histogram(s, s->program_hist.unit, s->program_ns);
+        s->program_ns = 0;
+    }
+
+    s->program_hist.unit = unit;
+    s->program_sector = sector;
+    s->program_ns += ns;
+}
+
+static void program_time_done(struct willem_session *s)
+{
+    if (s->program_ns > 0)
+    {
+        program_histogram(s, s->program_hist.unit, s->program_ns);
+        s->program_ns = 0;
+    }
+}
+
+static void set_address_width(struct willem_session *s, int addr_bits, const struct jumper_config *jc)
+{
+    if (jc != NULL)
+    {
+        bus_set_address_width(&s->bus, addr_bits, jc->hold_mask, jc->hold_value);
+    }
+    else
+    {
+        bus_set_address_width(&s->bus, addr_bits, 0, 0);
+    }
+}
+
+static void set_vcc(struct willem_session *s, bool value)
+{
+    s->bus.addr_latched = false;
+    pp_ucontrol(&s->pp, PARPORT_CONTROL_INIT, value ? PARPORT_CONTROL_INIT : 0);
+}
+
+static void set_vpp(struct willem_session *s, bool value)
+{
+    pp_ucontrol(&s->pp, PARPORT_CONTROL_STROBE, value ? PARPORT_CONTROL_STROBE : 0);
+}
+
+static void set_s4(struct willem_session *s, bool value)
+{
+    pp_ucontrol(&s->pp, PARPORT_CONTROL_SELECT, value ? PARPORT_CONTROL_SELECT : 0);
+}
+
+static void set_s6(struct willem_session *s, bool value)
+{
+    pp_ucontrol(&s->pp, PARPORT_CONTROL_AUTOFD, value ? 0 : PARPORT_CONTROL_AUTOFD);
+}
+
+static void write_data(struct willem_session *s, uint32_t addr, uint8_t value)
+{
+    bus_write_data_w_delay(&s->bus, addr, value, 0);
+}
+
+static uint8_t read_data(struct willem_session *s, uint32_t addr, bool pulse_s4)
+{
+    return bus_read_data(&s->bus, addr, pulse_s4);
+}
+
+/*
+ * EPROM outputs are enabled by S4, which a single read pulses around the
+ * byte. Passes over a range of addresses keep them enabled from
+ * read_seq_begin() to read_seq_end() and read with read_data(s, addr, false)
+ * in between, so a byte only costs the address shift and the readout. Flash
+ * outputs are always enabled while S6 is low, eprom false leaves S4 alone.
+ */
+static void read_seq_begin(struct willem_session *s, bool eprom)
+{
+    if (eprom)
+    {
+        set_s4(s, false);
+    }
+}
+
+static void read_seq_end(struct willem_session *s, bool eprom)
+{
+    if (eprom)
+    {
+        set_s4(s, true);
+    }
+}
+
+/*
+ * Reads len bytes at addr back and compares them with data. Returns 0 if
+ * they match, -1 otherwise.
+ */
+static int verify_range(struct willem_session *s, uint32_t addr, const uint8_t *data, size_t len, bool eprom)
+{
+    int res = 0;
+
+    read_seq_begin(s, eprom);
+
+    for (size_t i = 0; !s->terminate && i < len; i++)
+    {
+        uint8_t byte = read_data(s, addr + i, false);
+
+        if (byte != data[i])
+        {
+            fail(s, "Verification failed at 0x%08x: expected 0x%02x, actual 0x%02x\n", (uint32_t) (addr + i), data[i], byte);
+            res = -1;
+            break;
+        }
+    }
+
+    read_seq_end(s, eprom);
+
+    return res;
+}
+
+/*
+ * Fills scratch with the bytes of data still to be programmed at addr and
+ * 0xff, which programming skips, for the bytes the chip already holds. Used
+ * for the block an interrupted write may have left half done.
+ */
+static const uint8_t *skip_written(struct willem_session *s, uint32_t addr, const uint8_t *data, size_t len, uint8_t *scratch, bool eprom)
+{
+    read_seq_begin(s, eprom);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        scratch[i] = (read_data(s, addr + i, false) == data[i]) ? 0xff : data[i];
+    }
+
+    read_seq_end(s, eprom);
+
+    return scratch;
+}
+
+static uint16_t flash_id(struct willem_session *s)
+{
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0x90);
+    pp_udelay(&s->pp, 10000);
+
+    uint16_t id = read_data(s, 0, false) << 8;
+    id |= read_data(s, 1, false);
+
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0xf0);
+    pp_udelay(&s->pp, 10000);
+
+    return id;
+}
+
+/*
+ * Loads data with a single program command, either one byte or an AT29C page.
+ * Page loads are aborted as soon as the gap between two byte loads exceeds
+ * the byte load window because the chip has already started writing the
+ * partial page. Returns the number of bytes loaded before that.
+ */
+static size_t flash_write(struct willem_session *s, uint32_t addr, const uint8_t *data, size_t len)
+{
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0xa0);
+
+    uint64_t prev = 0;
+    uint64_t worst = 0;
+    size_t loaded = 0;
+
+    if (len > 1)
+    {
+        pp_trace_mark(&s->pp, TRACE_PAGE_START);
+    }
+
+    while (loaded < len)
+    {
+        write_data(s, addr + loaded, data[loaded]);
+
+        uint64_t now = pp_time(&s->pp);
+
+        if (loaded > 0 && now - prev > worst)
+        {
+            worst = now - prev;
+
+            if (worst > TBLC_LOAD_USEC * 1000ULL)
+            {
+                break;
+            }
+        }
+
+        prev = now;
+        loaded++;
+    }
+
+    if (len > 1)
+    {
+        pp_trace_mark(&s->pp, TRACE_PAGE_END);
+        rt_account(&s->rt_stats, worst, TBLC_LOAD_USEC * 1000ULL);
+    }
+
+    return loaded;
+}
+
+/*
+ * Unlock bypass lets a byte be programmed with two cycles instead of four.
+ * Program and exit cycles take any address, so the byte address is used to
+ * keep the shift register from changing.
+ */
+static void flash_bypass_enter(struct willem_session *s)
+{
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0x20);
+}
+
+static void flash_bypass_write(struct willem_session *s, uint32_t addr, uint8_t value)
+{
+    write_data(s, addr, 0xa0);
+    write_data(s, addr, value);
+}
+
+static void flash_bypass_exit(struct willem_session *s, uint32_t addr)
+{
+    write_data(s, addr, 0x90);
+    write_data(s, addr, 0x00);
+}
+
+static void flash_erase(struct willem_session *s)
+{
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0x80);
+
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0x10);
+}
+
+static void flash_sector_erase(struct willem_session *s, uint32_t addr)
+{
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, 0x5555, 0x80);
+
+    write_data(s, 0x5555, 0xaa);
+    write_data(s, 0x2aaa, 0x55);
+    write_data(s, addr, 0x30);
+}
+
+/*
+ * Finds the erase unit containing addr: an erase sector or, for chips
+ * written in pages, a page. Stores its start in *start and returns its size
+ * or 0 if the chip has neither.
+ */
+static uint32_t flash_sector(const struct chip_config *cc, uint32_t addr, uint32_t *start)
+{
+    if (cc->sectors == NULL)
+    {
+        if (cc->sector_size == 0)
+        {
+            return 0;
+        }
+
+        *start = addr - addr % cc->sector_size;
+        return cc->sector_size;
+    }
+
+    uint32_t base = 0;
+
+    for (const struct erase_region *r = cc->sectors; r->size > 0; r++)
+    {
+        if (addr < base + r->size * r->count)
+        {
+            *start = base + (addr - base) / r->size * r->size;
+            return r->size;
+        }
+
+        base += r->size * r->count;
+    }
+
+    return 0;
+}
+
+/*
+ * Waits for an embedded program or erase operation at addr to complete.
+ * While it is in progress DQ7 reads as the complement of the expected data
+ * and DQ6 toggles on every read. Returns 0 on completion, -1 on timeout,
+ * exceeded timing limits reported on DQ5 or termination.
+ */
+static int flash_wait(struct willem_session *s, const struct chip_config *cc, uint32_t addr, uint8_t expected, unsigned long timeout_usec, unsigned int poll_usec)
+{
+    uint64_t prev_time = pp_time(&s->pp);
+    uint64_t deadline = prev_time + timeout_usec * 1000ULL;
+    uint8_t prev = read_data(s, addr, false);
+
+    while (!s->terminate)
+    {
+        uint64_t time = pp_time(&s->pp);
+        uint8_t cur = read_data(s, addr, false);
+        bool toggling = ((prev ^ cur) & 0x40) != 0;
+
+        s->status_polls++;
+
+        if (!toggling && ((cur ^ expected) & 0x80) == 0)
+        {
+            return 0;
+        }
+
+        if ((cc->flags & CHIP_DQ5) && (cur & 0x20))
+        {
+            /* DQ5 may be set right as the operation completes */
+            prev = cur;
+            cur = read_data(s, addr, false);
+
+            return (((prev ^ cur) & 0x40) == 0 && ((cur ^ expected) & 0x80) == 0) ? 0 : -1;
+        }
+
+        /* Fail only if both compared reads started after the deadline */
+        if (prev_time > deadline)
+        {
+            return -1;
+        }
+
+        if (poll_usec)
+        {
+            pp_udelay(&s->pp, poll_usec);
+        }
+
+        prev = cur;
+        prev_time = time;
+    }
+
+    return -1;
+}
+
+/*
+ * Returns the chip to reading data after a failed program at addr. A still
+ * running embedded algorithm ignores commands, so it is waited for, then
+ * reset clears a DQ5 failure. Unlock bypass is kept and can be left after.
+ */
+static void flash_reset(struct willem_session *s, const struct chip_config *cc, uint32_t addr)
+{
+    uint64_t deadline = pp_time(&s->pp) + cc->max_write_usec * 1000ULL;
+    uint8_t prev = read_data(s, addr, false);
+
+    while (pp_time(&s->pp) < deadline)
+    {
+        uint8_t cur = read_data(s, addr, false);
+
+        /* DQ6 keeps toggling after a DQ5 failure */
+        if (((prev ^ cur) & 0x40) == 0 || ((cc->flags & CHIP_DQ5) && (cur & 0x20)))
+        {
+            break;
+        }
+
+        prev = cur;
+    }
+
+    write_data(s, addr, 0xf0);
+    pp_udelay(&s->pp, FLASH_RESET_USEC);
+}
+
+/*
+ * Writes a single AT29C page, or part of it, reloading it if the byte load
+ * window was missed. Returns 0 on success, -1 on failure or termination.
+ */
+static int flash_program_page(struct willem_session *s, const struct chip_config *cc, uint32_t addr, const uint8_t *data, size_t len)
+{
+    uint64_t start = pp_time(&s->pp);
+
+    for (int retry = 0; !s->terminate; ++retry)
+    {
+        size_t loaded = flash_write(s, addr, data, len);
+
+        /* Page write starts once the byte load window expires */
+        pp_udelay(&s->pp, TBLC_USEC);
+
+        /* A truncated page is still written, wait for it before reloading */
+        uint32_t last = loaded - 1;
+
+        if (flash_wait(s, cc, addr + last, data[last], cc->max_write_usec, 0) == -1 && !s->terminate)
+        {
+            fail(s, "Write failed at 0x%08x\n", addr);
+            return -1;
+        }
+
+        if (loaded == len)
+        {
+            program_histogram(s, cc->sector_size, pp_time(&s->pp) - start);
+            return 0;
+        }
+
+        if (retry == 0)
+        {
+            s->pages_retried++;
+        }
+
+        if (retry == PAGE_RETRIES)
+        {
+            fail(s, "Write failed at 0x%08x, byte load window missed %d times\n", addr, retry + 1);
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Programs len bytes at addr, page by page for AT29C chips and byte by byte
+ * otherwise. Erased (0xff) bytes and pages are skipped. Returns 0 on success,
+ * -1 on failure or termination.
+ */
+static int flash_program(struct willem_session *s, const struct chip_config *cc, uint32_t addr, const uint8_t *data, size_t len)
+{
+    if (cc->sector_size > 0)
+    {
+        while (!s->terminate && len > 0)
+        {
+            size_t page_len = cc->sector_size - addr % cc->sector_size;
+            bool empty = true;
+
+            if (page_len > len)
+            {
+                page_len = len;
+            }
+
+            for (size_t i = 0; empty && i < page_len; ++i)
+            {
+                if (data[i] != 0xff)
+                {
+                    empty = false;
+                }
+            }
+
+            if (!empty && flash_program_page(s, cc, addr, data, page_len) == -1)
+            {
+                return -1;
+            }
+
+            addr += page_len;
+            data += page_len;
+            len -= page_len;
+        }
+
+        return s->terminate ? -1 : 0;
+    }
+
+    const bool bypass = (cc->flags & CHIP_UNLOCK_BYPASS) != 0;
+    int res = 0;
+
+    if (bypass)
+    {
+        flash_bypass_enter(s);
+    }
+
+    for (size_t i = 0; !s->terminate && i < len; ++i)
+    {
+        if (data[i] == 0xff)
+        {
+            continue;
+        }
+
+        if (bypass)
+        {
+            flash_bypass_write(s, addr + i, data[i]);
+        }
+        else
+        {
+            flash_write(s, addr + i, &data[i], 1);
+        }
+
+        if (flash_wait(s, cc, addr + i, data[i], cc->max_write_usec, 0) == -1 && !s->terminate)
+        {
+            fail(s, "Write failed at 0x%08x\n", (uint32_t) (addr + i));
+            flash_reset(s, cc, addr + i);
+            res = -1;
+            break;
+        }
+    }
+
+    if (bypass)
+    {
+        flash_bypass_exit(s, addr);
+    }
+
+    return s->terminate ? -1 : res;
+}
+
+enum plan_action
+{
+    PLAN_SKIP,                          /* Chip already holds the data */
+    PLAN_PROGRAM,                       /* Only 1 to 0 changes, program without erase */
+    PLAN_ERASE,                         /* Erase the sector and program it */
+    PLAN_PAGE                           /* Write the whole AT29C page */
+};
+
+static const char *plan_action_names[] = { "skip", "program", "erase+program", "page write" };
+
+struct plan_unit
+{
+    uint32_t start;
+    uint32_t len;
+    enum plan_action action;
+    uint32_t bytes;                     /* Bytes to program */
+};
+
+/*
+ * Splits [start, end) into erase units and decides what each of them needs
+ * to get from current to wanted contents, both indexed by chip address.
+ * With units set to NULL only counts the units. Returns the number of units.
+ */
+static unsigned int plan_build(const struct chip_config *cc, const uint8_t *current, const uint8_t *wanted, uint32_t start, uint32_t end, struct plan_unit *units)
+{
+    unsigned int count = 0;
+
+    for (uint32_t addr = start; addr < end; count++)
+    {
+        uint32_t unit_start = addr;
+        uint32_t len = flash_sector(cc, addr, &unit_start);
+
+        if (len == 0)
+        {
+            break;
+        }
+
+        if (units != NULL)
+        {
+            struct plan_unit *u = &units[count];
+            bool erase = false;
+
+            u->start = unit_start;
+            u->len = len;
+            u->bytes = 0;
+
+            for (uint32_t i = unit_start; i < unit_start + len; i++)
+            {
+                if (current[i] != wanted[i])
+                {
+                    u->bytes++;
+                }
+
+                if ((current[i] & wanted[i]) != wanted[i])
+                {
+                    erase = true;
+                }
+            }
+
+            if (u->bytes == 0)
+            {
+                u->action = PLAN_SKIP;
+            }
+            else if (cc->sector_size > 0)
+            {
+                u->action = PLAN_PAGE;
+                u->bytes = len;
+            }
+            else if (erase)
+            {
+                u->action = PLAN_ERASE;
+                u->bytes = 0;
+
+                for (uint32_t i = unit_start; i < unit_start + len; i++)
+                {
+                    if (wanted[i] != 0xff)
+                    {
+                        u->bytes++;
+                    }
+                }
+            }
+            else
+            {
+                u->action = PLAN_PROGRAM;
+            }
+        }
+
+        addr = unit_start + len;
+    }
+
+    return count;
+}
+
+/*
+ * Estimates plan execution time from typical chip timings and the measured
+ * time of a single bus access.
+ */
+static uint64_t plan_estimate(const struct chip_config *cc, const struct plan_unit *units, unsigned int count, uint64_t access_ns)
+{
+    /* Bus cycles per programmed byte, including one status poll */
+    unsigned int cycles = (cc->flags & CHIP_UNLOCK_BYPASS) ? 3 : 5;
+    uint64_t ns = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const struct plan_unit *u = &units[i];
+
+        switch (u->action)
+        {
+        case PLAN_SKIP:
+            break;
+
+        case PLAN_ERASE:
+            ns += 6 * access_ns + cc->typ_sector_erase_msec * 1000000ULL;
+            /* fall through */
+
+        case PLAN_PROGRAM:
+            ns += u->bytes * (cycles * access_ns + cc->typ_write_usec * 1000ULL);
+            break;
+
+        case PLAN_PAGE:
+            ns += (u->len + 4) * access_ns + (TBLC_USEC + cc->typ_write_usec) * 1000ULL;
+            break;
+        }
+    }
+
+    return ns;
+}
+
+/*
+ * Programs an EPROM byte with VPP already on. Short pulses are applied until
+ * the byte reads back correctly, then an overprogram pulse proportional to
+ * the number of pulses needed. The byte is read back with VPP off as not
+ * every chip can be verified with VPP applied. Returns 0 on success, -1 if
+ * the byte did not program within max_pulses.
+ */
+static int eprom_program(struct willem_session *s, const struct chip_config *cc, uint32_t addr, uint8_t value)
+{
+    for (unsigned int n = 1; n <= cc->max_pulses; ++n)
+    {
+        bus_write_data_w_delay(&s->bus, addr, value, cc->pulse_usec);
+        s->eprom_pulses++;
+
+        set_vpp(s, false);
+        pp_udelay(&s->pp, VPP_SETTLE_USEC);
+        uint8_t actual = read_data(s, addr, true);
+        set_vpp(s, true);
+        pp_udelay(&s->pp, VPP_SETTLE_USEC);
+
+        if (actual == value)
+        {
+            if (cc->overprogram > 0)
+            {
+                bus_write_data_w_delay(&s->bus, addr, value, cc->overprogram * n * cc->pulse_usec);
+            }
+
+            s->eprom_bytes++;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Prepares a session for the board on the given port. The job and the
+ * callbacks, which may be NULL, must stay valid while the session is used.
+ */
+void willem_init(struct willem_session *s, const char *port, const struct willem_job *job, const struct willem_callbacks *cb)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->port = port;
+    s->job = job;
+
+    if (cb != NULL)
+    {
+        s->cb = *cb;
+    }
+}
+
+/*
+ * Claims the port of the board. Returns 0 on success, -1 on failure.
+ */
+int willem_open(struct willem_session *s)
+{
+    if (pp_open(&s->pp, s->port) == -1)
+    {
+        fail(s, "%s: %s\n", s->port, strerror(errno));
+        return -1;
+    }
+
+    if (s->trace != NULL && pp_trace_open(&s->pp, s->trace, s->port) == -1)
+    {
+        fail(s, "%s: %s\n", s->trace, strerror(errno));
+        pp_close(&s->pp);
+        return -1;
+    }
+
+    s->pp.paranoid = s->job->paranoid;
+    bus_init(&s->bus, &s->pp, &s->rt_stats);
+
+    if (s->timing != NULL)
+    {
+        s->bus.timing = *s->timing;
+    }
+
+    s->stats_phase = WILLEM_PHASE_IDLE;
+    stats_read(s, &s->stats_mark);
+
+    return 0;
+}
+
+/* Puts the board in a known state with power off */
+void willem_reset(struct willem_session *s)
+{
+    pp_wdata(&s->pp, 0);
+    set_s4(s, true);
+    set_s6(s, true);
+    set_vpp(s, false);
+    set_vcc(s, false);
+}
+
+/*
+ * Powers the chip up and identifies it, unless the chip was given. Returns 0
+ * on success, -1 on failure with the power turned off again.
+ */
+int willem_power_on(struct willem_session *s)
+{
+    const struct willem_job *job = s->job;
+
+    stats_enter(s, WILLEM_PHASE_ID);
+    set_vcc(s, true);
+
+    pp_udelay(&s->pp, POWER_ON_USEC);
+
+    const struct chip_config *cc = NULL;
+
+    if (job->chip != NULL)
+    {
+        cc = find_chip(job->chip);
+
+        if (cc == NULL)
+        {
+            fail(s, "Unknown chip '%s'\n", job->chip);
+            goto failure;
+        }
+
+        if (job->eprom != ((cc->flags & CHIP_EPROM) != 0))
+        {
+            fail(s, "Chip %s is not %s\n", cc->name, job->eprom ? "an EPROM" : "a flash memory");
+            goto failure;
+        }
+    }
+    else if (job->flash)
+    {
+        uint16_t chip_id = flash_id(s);
+
+        s->chip_id = chip_id;
+
+        for (int i = 0; i < sizeof(chip_config) / sizeof(chip_config[0]); ++i)
+        {
+            if (chip_id == chip_config[i].id)
+            {
+                cc = &chip_config[i];
+                break;
+            }
+        }
+
+        if (cc == NULL) 
+        {
+            fail(s, "Chip id 0x%04x not supported\n", chip_id);
+            goto failure;
+        }
+
+        info(s, "Chip id 0x%04x (%s)\n", chip_id, cc->name);
+    }
+
+    if (cc != NULL)
+    {
+        set_address_width(s, cc->addr_bits, (job->jc != NULL) ? job->jc : willem_find_jumpers(cc->jumpers));
+    }
+    else if (job->jc != NULL)
+    {
+        set_address_width(s, job->jc->addr_bits, job->jc);
+    }
+
+    s->cc = cc;
+    s->powered = true;
+    stats_enter(s, WILLEM_PHASE_IDLE);
+
+    if (s->cb.identified != NULL)
+    {
+        s->cb.identified(s->cb.arg);
+    }
+
+    return 0;
+
+failure:
+    set_vcc(s, false);
+    stats_enter(s, WILLEM_PHASE_IDLE);
+    return -1;
+}
+
+void willem_power_off(struct willem_session *s)
+{
+    info(s, "Turning off\n");
+    set_vcc(s, false);
+    pp_udelay(&s->pp, 100000);
+    s->powered = false;
+}
+
+/*
+ * Runs the selected operations on a powered chip. Returns 0 on success, -1 on
+ * failure.
+ */
+int willem_run_job(struct willem_session *s, const struct willem_job *job)
+{
+    const struct chip_config *cc = s->cc;
+    uint32_t size = job->size;
+
+    if (size == 0 && cc != NULL)
+    {
+        size = cc->size;
+    }
+
+    if ((job->do_read || job->do_crc) && size == 0)
+    {
+        fail(s, "Need to provide memory size\n");
+        return -1;
+    }
+
+    /* An interrupted write being resumed already erased the chip */
+    if (job->flash && job->do_erase && (job->do_write == NULL || job->resume == 0))
+    {
+        stats_enter(s, WILLEM_PHASE_ERASE);
+        flash_erase(s);
+
+        phase(s, "Erasing");
+
+        if (flash_wait(s, cc, 0, 0xff, cc->max_chip_erase_sec * 1000000UL, ERASE_POLL_USEC) == -1 && !s->terminate)
+        {
+            fail(s, "Erase failed\n");
+            goto failure;
+        }
+
+        if (!s->terminate)
+        {
+            info(s, "Erase complete\n");
+        }
+
+        stats_enter(s, WILLEM_PHASE_IDLE);
+    }
+
+    if (!s->terminate && job->eprom && job->do_erase)
+    {
+        stats_enter(s, WILLEM_PHASE_ERASE);
+        bus_write_address(&s->bus, 0);
+        set_s6(s, true);
+        pp_wdata(&s->pp, 0xff);
+
+        set_vpp(s, true);
+        set_s4(s, false);
+        pp_udelay(&s->pp, 100000);
+        set_s4(s, true);
+        set_vpp(s, false);
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        info(s, "Erase complete\n");
+    }
+
+    /* Blank check, read and checksum share a single scan */
+    if (!s->terminate && (job->do_blank_check || job->do_read || job->do_crc))
+    {
+        const char *label = job->do_read ? "Reading" : (job->do_blank_check ? "Blank check" : "Checksum");
+        uint8_t chunk[BLOCK_SIZE];
+        uint32_t crc = 0;
+        uint32_t blank_fail = UINT32_MAX;
+        uint8_t blank_byte = 0xff;
+        uint32_t addr;
+
+        if (job->do_read && s->cb.read_chunk == NULL)
+        {
+            fail(s, "No read callback\n");
+            goto failure;
+        }
+
+        /* Only a plain read can continue where an earlier one stopped */
+        uint32_t start = (job->do_read && !job->do_blank_check && !job->do_crc) ? job->resume - job->resume % BLOCK_SIZE : 0;
+
+        stats_enter(s, (job->do_read || job->do_crc) ? WILLEM_PHASE_READ : WILLEM_PHASE_BLANK_CHECK);
+        read_seq_begin(s, job->eprom);
+
+        for (addr = start; !s->terminate && addr < size; addr++)
+        {
+            if (addr % 1024 == 0)
+            {
+                progress(s, label, addr / 1024);
+            }
+
+            uint8_t byte = read_data(s, job->offset + addr, false);
+
+            chunk[addr % sizeof(chunk)] = byte;
+
+            if (addr % sizeof(chunk) == sizeof(chunk) - 1)
+            {
+                crc = crc32_update(crc, chunk, sizeof(chunk));
+
+                if (job->do_read && s->cb.read_chunk(s->cb.arg, job->offset + addr + 1 - sizeof(chunk), chunk, sizeof(chunk)) == -1)
+                {
+                    read_seq_end(s, job->eprom);
+                    fail(s, "Storing read data failed: %s\n", strerror(errno));
+                    goto failure;
+                }
+            }
+
+            if (byte != 0xff && job->do_blank_check && blank_fail == UINT32_MAX)
+            {
+                blank_fail = addr;
+                blank_byte = byte;
+
+                /* Nothing else needs the rest of the chip */
+                if (!job->do_read && !job->do_crc)
+                {
+                    break;
+                }
+            }
+        }
+
+        uint32_t tail = addr % sizeof(chunk);
+
+        read_seq_end(s, job->eprom);
+        stats_bytes(s, addr - start);
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        crc = crc32_update(crc, chunk, tail);
+        s->crc = crc;
+
+        if (!s->terminate && job->do_read)
+        {
+            if (tail > 0 && s->cb.read_chunk(s->cb.arg, job->offset + addr - tail, chunk, tail) == -1)
+            {
+                fail(s, "Storing read data failed: %s\n", strerror(errno));
+                goto failure;
+            }
+
+            info(s, "Read complete\n");
+        }
+
+        if (!s->terminate && job->do_crc)
+        {
+            info(s, "CRC32: %08x\n", crc);
+        }
+
+        if (blank_fail != UINT32_MAX)
+        {
+            fail(s, "Black check failed at 0x%08x: 0x%02x\n", job->offset + blank_fail, blank_byte);
+            goto failure;
+        }
+
+        if (!s->terminate && job->do_blank_check)
+        {
+            info(s, "Blank check complete\n");
+        }
+    }
+
+    if (!s->terminate && job->eprom && job->do_write != NULL)
+    {
+        const struct chip_config *ec = (cc != NULL) ? cc : &eprom_default;
+        uint32_t start = job->resume - job->resume % BLOCK_SIZE;
+        uint8_t scratch[BLOCK_SIZE];
+
+        /* Outputs need VPP off, so look at the first block before raising it */
+        if (job->resume > 0 && start < job->image_len)
+        {
+            uint32_t len = (job->image_len - start < BLOCK_SIZE) ? job->image_len - start : BLOCK_SIZE;
+
+            skip_written(s, job->offset + start, job->image + start, len, scratch, true);
+        }
+
+        stats_enter(s, WILLEM_PHASE_WRITE);
+        set_vpp(s, true);
+        pp_udelay(&s->pp, VPP_SETTLE_USEC);
+
+        for (uint32_t addr = start; !s->terminate && addr < job->image_len; addr += BLOCK_SIZE)
+        {
+            const uint8_t *buf = job->image + addr;
+            const uint8_t *data = (job->resume > 0 && addr == start) ? scratch : buf;
+            uint32_t len = (job->image_len - addr < BLOCK_SIZE) ? job->image_len - addr : BLOCK_SIZE;
+            uint64_t block_start = pp_time(&s->pp);
+
+            progress(s, "Writing", addr / 1024);
+
+            for (uint32_t i = 0; i < len; ++i)
+            {
+                if (data[i] != 0xff && eprom_program(s, ec, job->offset + addr + i, data[i]) == -1)
+                {
+                    set_vpp(s, false);
+                    fail(s, "Write failed at 0x%08x after %u pulses\n", job->offset + addr + i, ec->max_pulses);
+                    goto failure;
+                }
+            }
+
+            /* EPROMs have no sectors, blocks are timed instead */
+            stats_bytes(s, len);
+            program_time(s, addr, BLOCK_SIZE, pp_time(&s->pp) - block_start);
+
+            /* Verify every block right after writing it, outputs need VPP off */
+            if (job->do_verify && !s->terminate)
+            {
+                set_vpp(s, false);
+                pp_udelay(&s->pp, VPP_SETTLE_USEC);
+                stats_enter(s, WILLEM_PHASE_VERIFY);
+
+                if (verify_range(s, job->offset + addr, buf, len, true) == -1)
+                {
+                    goto failure;
+                }
+
+                stats_bytes(s, len);
+                stats_enter(s, WILLEM_PHASE_WRITE);
+                set_vpp(s, true);
+                pp_udelay(&s->pp, VPP_SETTLE_USEC);
+            }
+
+            if (!s->terminate && s->cb.written != NULL)
+            {
+                s->cb.written(s->cb.arg, addr + len);
+            }
+        }
+
+        set_vpp(s, false);
+        program_time_done(s);
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        /* Blocks written by the interrupted run are verified too */
+        if (!s->terminate && job->do_verify && start > 0 && willem_verify(s, job->offset, job->image, start) == -1)
+        {
+            goto failure;
+        }
+
+        if (!s->terminate)
+        {
+            info(s, job->do_verify ? "Write and verify complete\n" : "Write complete\n");
+        }
+    }
+
+    if (!s->terminate && job->flash && job->do_write != NULL && !job->incremental)
+    {
+        uint32_t start = job->resume - job->resume % BLOCK_SIZE;
+        uint8_t scratch[BLOCK_SIZE];
+
+        stats_enter(s, WILLEM_PHASE_WRITE);
+
+        for (uint32_t addr = start; !s->terminate && addr < job->image_len; addr += BLOCK_SIZE)
+        {
+            const uint8_t *buf = job->image + addr;
+            const uint8_t *data = buf;
+            uint32_t len = (job->image_len - addr < BLOCK_SIZE) ? job->image_len - addr : BLOCK_SIZE;
+            uint64_t block_start;
+
+            progress(s, "Writing", addr / 1024);
+
+            /* Page mode chips don't keep unloaded bytes, those pages are written whole again */
+            if (job->resume > 0 && addr == start && cc->sector_size == 0)
+            {
+                data = skip_written(s, job->offset + addr, buf, len, scratch, false);
+            }
+
+            block_start = pp_time(&s->pp);
+
+            if (flash_program(s, cc, job->offset + addr, data, len) == -1 && !s->terminate)
+            {
+                goto failure;
+            }
+
+            stats_bytes(s, len);
+
+            /* Pages time themselves, other chips are timed per sector or, without sectors, per block */
+            if (cc->sector_size == 0)
+            {
+                uint32_t sector = job->offset + addr;
+                uint32_t unit = flash_sector(cc, sector, &sector);
+
+                program_time(s, sector, (unit > 0) ? unit : BLOCK_SIZE, pp_time(&s->pp) - block_start);
+            }
+
+            /* Verify every block right after writing it */
+            if (job->do_verify)
+            {
+                stats_enter(s, WILLEM_PHASE_VERIFY);
+
+                if (verify_range(s, job->offset + addr, buf, len, false) == -1)
+                {
+                    goto failure;
+                }
+
+                stats_bytes(s, len);
+                stats_enter(s, WILLEM_PHASE_WRITE);
+            }
+
+            if (!s->terminate && s->cb.written != NULL)
+            {
+                s->cb.written(s->cb.arg, addr + len);
+            }
+        }
+
+        program_time_done(s);
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        /* Blocks written by the interrupted run are verified too */
+        if (!s->terminate && job->do_verify && start > 0 && willem_verify(s, job->offset, job->image, start) == -1)
+        {
+            goto failure;
+        }
+
+        if (!s->terminate)
+        {
+            info(s, job->do_verify ? "Write and verify complete\n" : "Write complete\n");
+        }
+
+        if (s->pages_retried > 0)
+        {
+            info(s, "Pages reloaded after a missed byte load window: %lu\n", s->pages_retried);
+        }
+    }
+
+    if (!s->terminate && job->flash && job->do_write != NULL && job->incremental)
+    {
+        uint32_t start = 0, end = 0, len;
+
+        if (flash_sector(cc, 0, &start) == 0)
+        {
+            fail(s, "%s has neither sector erase nor page writes\n", cc->name);
+            goto failure;
+        }
+
+        if (job->offset >= cc->size)
+        {
+            fail(s, "Offset beyond chip size\n");
+            goto failure;
+        }
+
+        /* Whatever does not fit in the chip is ignored */
+        uint32_t image_len = (job->image_len < cc->size - job->offset) ? job->image_len : cc->size - job->offset;
+
+        if (image_len == 0)
+        {
+            fail(s, "Empty file %s\n", job->do_write);
+            goto failure;
+        }
+
+        uint8_t *current = malloc(cc->size);
+        uint8_t *wanted = malloc(cc->size);
+        uint8_t *scratch = malloc(cc->size);
+
+        if (current == NULL || wanted == NULL || scratch == NULL)
+        {
+            fail(s, "%s: %s\n", "malloc", strerror(errno));
+            free(current);
+            free(wanted);
+            free(scratch);
+            goto failure;
+        }
+
+        /* No page faults while comparing and programming */
+        rt_prefault(current, cc->size);
+        rt_prefault(wanted, cc->size);
+        rt_prefault(scratch, cc->size);
+
+        /* Whole erase units covering the file */
+        flash_sector(cc, job->offset, &start);
+        len = flash_sector(cc, job->offset + image_len - 1, &end);
+        end += len;
+
+        uint64_t read_start = pp_time(&s->pp);
+
+        stats_enter(s, WILLEM_PHASE_READ);
+
+        for (uint32_t addr = start; !s->terminate && addr < end; addr++)
+        {
+            if (addr % 1024 == 0)
+            {
+                progress(s, "Reading", addr / 1024);
+            }
+
+            current[addr] = read_data(s, addr, false);
+        }
+
+        uint64_t access_ns = (pp_time(&s->pp) - read_start) / (end - start);
+
+        stats_bytes(s, end - start);
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        /* Data outside the file is preserved */
+        memcpy(wanted + start, current + start, end - start);
+        memcpy(wanted + job->offset, job->image, image_len);
+
+        unsigned int count = plan_build(cc, current, wanted, start, end, NULL);
+        struct plan_unit *units = malloc(count * sizeof(units[0]));
+        unsigned int actions[4] = { 0 };
+        int res = 0;
+
+        if (units == NULL)
+        {
+            fail(s, "%s: %s\n", "malloc", strerror(errno));
+            free(current);
+            free(wanted);
+            free(scratch);
+            goto failure;
+        }
+
+        plan_build(cc, current, wanted, start, end, units);
+
+        info(s, "Plan for 0x%08x-0x%08x:\n", start, end - 1);
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            actions[units[i].action]++;
+
+            if (units[i].action != PLAN_SKIP)
+            {
+                info(s, "  0x%08x-0x%08x  %-14s %u bytes\n", units[i].start, units[i].start + units[i].len - 1, plan_action_names[units[i].action], units[i].bytes);
+            }
+        }
+
+        info(s, "Plan: %u skipped, %u programmed, %u erased, %u page writes, estimated %.1f s\n",
+               actions[PLAN_SKIP], actions[PLAN_PROGRAM], actions[PLAN_ERASE], actions[PLAN_PAGE],
+               plan_estimate(cc, units, count, access_ns) / 1e9);
+
+        stats_enter(s, WILLEM_PHASE_WRITE);
+
+        for (unsigned int i = 0; !s->terminate && res == 0 && i < count; i++)
+        {
+            const struct plan_unit *u = &units[i];
+            uint64_t unit_start = pp_time(&s->pp);
+
+            progress(s, "Updating", u->start / 1024);
+
+            switch (u->action)
+            {
+            case PLAN_SKIP:
+                break;
+
+            case PLAN_PROGRAM:
+                /* Bytes already in place are skipped like erased ones */
+                for (uint32_t j = 0; j < u->len; j++)
+                {
+                    scratch[j] = (current[u->start + j] == wanted[u->start + j]) ? 0xff : wanted[u->start + j];
+                }
+
+                if (flash_program(s, cc, u->start, scratch, u->len) == -1 && !s->terminate)
+                {
+                    res = -1;
+                }
+                break;
+
+            case PLAN_ERASE:
+                flash_sector_erase(s, u->start);
+
+                if (flash_wait(s, cc, u->start, 0xff, cc->max_sector_erase_sec * 1000000UL, ERASE_POLL_USEC) == -1 && !s->terminate)
+                {
+                    fail(s, "Sector erase failed at 0x%08x\n", u->start);
+                    res = -1;
+                }
+                else if (flash_program(s, cc, u->start, wanted + u->start, u->len) == -1 && !s->terminate)
+                {
+                    res = -1;
+                }
+                break;
+
+            case PLAN_PAGE:
+                if (flash_program_page(s, cc, u->start, wanted + u->start, u->len) == -1 && !s->terminate)
+                {
+                    res = -1;
+                }
+                break;
+            }
+
+            if (u->action != PLAN_SKIP)
+            {
+                stats_bytes(s, u->len);
+            }
+
+            /* Sectors written byte by byte, including the erase */
+            if (res == 0 && (u->action == PLAN_PROGRAM || u->action == PLAN_ERASE) && cc->sector_size == 0)
+            {
+                program_histogram(s, u->len, pp_time(&s->pp) - unit_start);
+            }
+
+            /* Skipped units were compared by the initial read */
+            if (job->do_verify && res == 0 && u->action != PLAN_SKIP)
+            {
+                stats_enter(s, WILLEM_PHASE_VERIFY);
+                res = verify_range(s, u->start, wanted + u->start, u->len, false);
+                stats_bytes(s, u->len);
+                stats_enter(s, WILLEM_PHASE_WRITE);
+            }
+        }
+
+        stats_enter(s, WILLEM_PHASE_IDLE);
+
+        free(units);
+        free(current);
+        free(wanted);
+        free(scratch);
+
+        if (res == -1)
+        {
+            goto failure;
+        }
+
+        if (!s->terminate)
+        {
+            info(s, job->do_verify ? "Update and verify complete\n" : "Update complete\n");
+        }
+
+        if (s->pages_retried > 0)
+        {
+            info(s, "Pages reloaded after a missed byte load window: %lu\n", s->pages_retried);
+        }
+    }
+
+    return 0;
+
+failure:
+    program_time_done(s);
+    stats_enter(s, WILLEM_PHASE_IDLE);
+    return -1;
+}
+
+/*
+ * Compares len bytes at offset with data, block by block. Returns 0 if they
+ * match, -1 otherwise.
+ */
+int willem_verify(struct willem_session *s, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    int res = 0;
+
+    stats_enter(s, WILLEM_PHASE_VERIFY);
+
+    for (uint32_t addr = 0; !s->terminate && res == 0 && addr < len; addr += BLOCK_SIZE)
+    {
+        uint32_t block = (len - addr < BLOCK_SIZE) ? len - addr : BLOCK_SIZE;
+
+        progress(s, "Verifying", addr / 1024);
+
+        res = verify_range(s, offset + addr, data + addr, block, s->job->eprom);
+
+        if (res == 0)
+        {
+            stats_bytes(s, block);
+        }
+    }
+
+    stats_enter(s, WILLEM_PHASE_IDLE);
+
+    return (s->terminate || res == -1) ? -1 : 0;
+}
+
+const struct bus_timing willem_calibrate_start = { 4000, 4000, 4000 };
+
+/* Delays tried by calibration, slowest first */
+static const unsigned int calibrate_steps[] = { 4000, 2000, 1000, 500, 250, 100, 0 };
+
+struct calibrate_test
+{
+    uint8_t ref[CALIBRATE_BYTES];       /* Chip contents read at the start timing */
+    uint32_t len;
+    uint32_t region;                    /* Next unwritten region for write tests */
+};
+
+/* Reads the reference range sequentially, then with most address bits changing */
+static int calibrate_reads(struct willem_session *s, struct calibrate_test *ct)
+{
+    int res = 0;
+
+    read_seq_begin(s, s->job->eprom);
+
+    for (int pass = 0; res == 0 && pass < CALIBRATE_PASSES; pass++)
+    {
+        for (uint32_t i = 0; !s->terminate && i < ct->len; i++)
+        {
+            uint32_t addr = (pass & 1) ? (i * 0x9e5) % ct->len : i;
+
+            if (read_data(s, addr, false) != ct->ref[addr])
+            {
+                res = -1;
+                break;
+            }
+        }
+    }
+
+    read_seq_end(s, s->job->eprom);
+
+    return res;
+}
+
+/* Programs a pattern to a fresh erased region and reads it back slowly */
+static int calibrate_write(struct willem_session *s, struct calibrate_test *ct)
+{
+    struct bus_timing timing = s->bus.timing;
+    uint32_t addr = ct->region;
+    uint8_t data[CALIBRATE_REGION];
+    int res;
+
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (i * 0x1d + addr / CALIBRATE_REGION) ^ 0x5a;
+    }
+
+    ct->region += CALIBRATE_REGION;
+
+    if (ct->region > s->cc->size)
+    {
+        return -1;
+    }
+
+    res = flash_program(s, s->cc, addr, data, sizeof(data));
+    s->bus.timing = willem_calibrate_start;
+
+    for (uint32_t i = 0; res == 0 && i < sizeof(data); i++)
+    {
+        if (read_data(s, addr + i, false) != data[i])
+        {
+            res = -1;
+        }
+    }
+
+    s->bus.timing = timing;
+
+    return res;
+}
+
+/*
+ * Steps a delay down until the test fails. Leaves it at the shortest delay
+ * that worked plus the margin and returns 0, or -1 if none worked.
+ */
+static int calibrate_delay(struct willem_session *s, unsigned int *delay, int (*test)(struct willem_session *, struct calibrate_test *), struct calibrate_test *ct)
+{
+    int good = -1;
+
+    for (int i = 0; !s->terminate && i < sizeof(calibrate_steps) / sizeof(calibrate_steps[0]); i++)
+    {
+        *delay = calibrate_steps[i];
+
+        if (test(s, ct) == -1)
+        {
+            break;
+        }
+
+        good = i;
+    }
+
+    if (good == -1 || s->terminate)
+    {
+        return -1;
+    }
+
+    *delay = calibrate_steps[good] * (100 + CALIBRATE_MARGIN_PERCENT) / 100;
+
+    return 0;
+}
+
+/*
+ * Finds the shortest bus delays the board works with on a powered chip,
+ * starting from willem_calibrate_start. Reads are checked against the chip
+ * contents read at the start timing. With write_test a flash chip is
+ * erased, test patterns are programmed to tune the write setup time and the
+ * chip is erased again, otherwise the setup time is left as it is. The
+ * result is applied to the session. Returns 0 on success, -1 on failure.
+ */
+int willem_calibrate(struct willem_session *s, bool write_test, struct bus_timing *result)
+{
+    const struct chip_config *cc = s->cc;
+    struct bus_timing *t = &s->bus.timing;
+    void (*error)(void *, const char *) = s->cb.error;
+    struct calibrate_test *ct;
+    int res = -1;
+
+    if (write_test && (cc == NULL || (cc->flags & CHIP_EPROM) != 0))
+    {
+        fail(s, "Write test needs a flash chip\n");
+        return -1;
+    }
+
+    ct = calloc(1, sizeof(*ct));
+
+    if (ct == NULL)
+    {
+        fail(s, "%s: %s\n", "malloc", strerror(errno));
+        return -1;
+    }
+
+    ct->len = (cc != NULL && cc->size < CALIBRATE_BYTES) ? cc->size : CALIBRATE_BYTES;
+    *t = willem_calibrate_start;
+
+    /* Untested write setup stays at the default */
+    if (!write_test)
+    {
+        t->setup_ns = BUS_SETUP_NSEC;
+    }
+
+    /* Failed attempts are expected, only the outcome is reported */
+    s->cb.error = NULL;
+
+    if (write_test)
+    {
+        phase(s, "Erasing");
+        flash_erase(s);
+
+        if (flash_wait(s, cc, 0, 0xff, cc->max_chip_erase_sec * 1000000UL, ERASE_POLL_USEC) == -1)
+        {
+            s->cb.error = error;
+            fail(s, "Erase failed\n");
+            goto out;
+        }
+
+        phase(s, "Calibrating write setup");
+
+        if (calibrate_delay(s, &t->setup_ns, calibrate_write, ct) == -1)
+        {
+            s->cb.error = error;
+            fail(s, "Writes fail even with %u ns setup\n", calibrate_steps[0]);
+            goto out;
+        }
+    }
+
+    read_seq_begin(s, s->job->eprom);
+
+    for (uint32_t i = 0; i < ct->len; i++)
+    {
+        ct->ref[i] = read_data(s, i, false);
+    }
+
+    read_seq_end(s, s->job->eprom);
+
+    s->cb.error = error;
+
+    if (calibrate_reads(s, ct) == -1)
+    {
+        fail(s, "Reads differ even at the slowest timing\n");
+        goto out;
+    }
+
+    if (memchr(ct->ref, 0xff, ct->len) != NULL && memcmp(ct->ref, ct->ref + 1, ct->len - 1) == 0)
+    {
+        info(s, "Chip is blank, program it with varied data for a thorough read test\n");
+    }
+
+    phase(s, "Calibrating clock");
+
+    if (calibrate_delay(s, &t->clock_ns, calibrate_reads, ct) == -1)
+    {
+        fail(s, "Reads fail even with %u ns clock pacing\n", calibrate_steps[0]);
+        goto out;
+    }
+
+    phase(s, "Calibrating read settle");
+
+    if (calibrate_delay(s, &t->settle_ns, calibrate_reads, ct) == -1)
+    {
+        fail(s, "Reads fail even with %u ns settle time\n", calibrate_steps[0]);
+        goto out;
+    }
+
+    /* Everything at once, at the final timing */
+    phase(s, "Checking");
+    s->cb.error = NULL;
+
+    if (calibrate_reads(s, ct) == -1 || (write_test && calibrate_write(s, ct) == -1))
+    {
+        s->cb.error = error;
+        fail(s, "Calibrated timing failed the final check\n");
+        goto out;
+    }
+
+    s->cb.error = error;
+
+    if (write_test)
+    {
+        phase(s, "Erasing");
+        flash_erase(s);
+
+        if (flash_wait(s, cc, 0, 0xff, cc->max_chip_erase_sec * 1000000UL, ERASE_POLL_USEC) == -1)
+        {
+            fail(s, "Erase failed\n");
+            goto out;
+        }
+    }
+
+    *result = *t;
+    res = 0;
+
+out:
+    s->cb.error = error;
+    free(ct);
+
+    if (res == -1)
+    {
+        *t = willem_calibrate_start;
+    }
+
+    return (s->terminate) ? -1 : res;
+}
+
+/* Bus access costs of the estimated chip */
+struct estimate_bus
+{
+    double op_ns;
+    const struct bus_timing *timing;
+    unsigned int shift_ops;             /* Data writes of an address shift */
+    unsigned int read_ops;              /* Data writes and status reads of a readout */
+    unsigned int read_samples;
+};
+
+static void estimate_ops(const struct estimate_bus *eb, struct willem_phase_stats *st, uint64_t ops, uint64_t delay_ns)
+{
+    st->port_ops += ops;
+    st->delay_requested_ns += delay_ns;
+    st->time_ns += ops * eb->op_ns + delay_ns;
+}
+
+/* Reads n bytes, shifting the address for each of them if shift is set */
+static void estimate_reads(const struct estimate_bus *eb, struct willem_phase_stats *st, uint64_t n, bool shift)
+{
+    unsigned int writes = eb->read_ops - eb->read_samples + (shift ? eb->shift_ops : 0);
+
+    estimate_ops(eb, st, n * (eb->read_ops + (shift ? eb->shift_ops : 0)), n * (writes * eb->timing->clock_ns + eb->timing->settle_ns));
+
+    if (shift)
+    {
+        st->addr_shifts += n;
+    }
+}
+
+/* Writes n bytes of which shifts need an address shift, with the S4 strobe and S6 switches */
+static void estimate_writes(const struct estimate_bus *eb, struct willem_phase_stats *st, uint64_t n, uint64_t shifts)
+{
+    estimate_ops(eb, st, n * 5 + shifts * eb->shift_ops, 2 * n * eb->timing->setup_ns + shifts * eb->shift_ops * eb->timing->clock_ns);
+    st->addr_shifts += shifts;
+}
+
+/* Polls the status at the address written last until busy_ns has passed */
+static void estimate_wait(const struct estimate_bus *eb, struct willem_phase_stats *st, uint64_t busy_ns, unsigned int poll_usec)
+{
+    struct willem_phase_stats poll = { 0 };
+    uint64_t n;
+
+    estimate_reads(eb, &poll, 1, false);
+    n = 2 + busy_ns / (poll.time_ns + poll_usec * 1000ULL);
+
+    estimate_reads(eb, st, n, false);
+    estimate_ops(eb, st, 0, (n - 2) * poll_usec * 1000ULL);
+    st->status_polls += n - 1;
+}
+
+/* Programs the bytes of a block the way flash_program() does */
+static void estimate_flash_block(const struct estimate_bus *eb, struct willem_phase_stats *st, const struct chip_config *cc, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    const bool bypass = (cc->flags & CHIP_UNLOCK_BYPASS) != 0;
+    uint64_t bytes = 0;
+
+    if (cc->sector_size > 0)
+    {
+        while (len > 0)
+        {
+            uint32_t page_len = cc->sector_size - addr % cc->sector_size;
+
+            if (page_len > len)
+            {
+                page_len = len;
+            }
+
+            for (uint32_t i = 0; i < page_len; i++)
+            {
+                if (data[i] != 0xff)
+                {
+                    estimate_writes(eb, st, 3 + page_len, 3 + page_len);
+                    estimate_ops(eb, st, 0, TBLC_USEC * 1000ULL);
+                    estimate_wait(eb, st, cc->typ_write_usec * 1000ULL, 0);
+                    break;
+                }
+            }
+
+            addr += page_len;
+            data += page_len;
+            len -= page_len;
+        }
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        bytes += (data[i] != 0xff);
+    }
+
+    if (bypass)
+    {
+        estimate_writes(eb, st, 3 + 2 * bytes + 2, 3 + bytes + 1);
+    }
+    else
+    {
+        estimate_writes(eb, st, 4 * bytes, 4 * bytes);
+    }
+
+    for (uint64_t i = 0; i < bytes; i++)
+    {
+        estimate_wait(eb, st, cc->typ_write_usec * 1000ULL, 0);
+    }
+}
+
+/*
+ * Programs the bytes of a block the way eprom_program() does, assuming every
+ * byte takes a single pulse.
+ */
+static void estimate_eprom_block(const struct estimate_bus *eb, struct willem_phase_stats *st, const struct chip_config *cc, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (data[i] == 0xff)
+        {
+            continue;
+        }
+
+        estimate_writes(eb, st, 1, 1);
+        estimate_ops(eb, st, 2, (cc->pulse_usec + 2 * VPP_SETTLE_USEC) * 1000ULL);
+
+        /* Read back with S4 pulsed */
+        estimate_reads(eb, st, 1, false);
+        estimate_ops(eb, st, 3, 0);
+
+        if (cc->overprogram > 0)
+        {
+            estimate_writes(eb, st, 1, 0);
+            estimate_ops(eb, st, 0, cc->overprogram * cc->pulse_usec * 1000ULL);
+        }
+    }
+}
+
+/*
+ * Estimates the time and port accesses of every phase of the session's job
+ * without touching the chip. The chip is the identified one if the session
+ * is powered, otherwise the one selected by the job, an EPROM without one
+ * needs the size. Port access time is measured on the open port, delays
+ * and program and erase times use the bus timing of the session and the
+ * typical chip timings. EPROM bytes are assumed to program with one pulse,
+ * a blank check to pass and an incremental write to rewrite everything the
+ * image holds. Returns 0 on success, -1 on failure.
+ */
+int willem_estimate(struct willem_session *s, struct willem_estimate *e)
+{
+    const struct willem_job *job = s->job;
+    const struct chip_config *cc = s->cc;
+    struct estimate_bus eb = { 0 };
+    uint32_t size = job->size;
+    wave_t w = { .len = 0 };
+    uint64_t start;
+
+    memset(e, 0, sizeof(*e));
+
+    if (cc == NULL && job->chip != NULL)
+    {
+        cc = find_chip(job->chip);
+
+        if (cc == NULL)
+        {
+            fail(s, "Unknown chip '%s'\n", job->chip);
+            return -1;
+        }
+    }
+
+    if (cc == NULL && job->flash)
+    {
+        fail(s, "Flash chip needs to be identified or selected\n");
+        return -1;
+    }
+
+    /* Address width the job would run with */
+    if (!s->powered && cc != NULL)
+    {
+        set_address_width(s, cc->addr_bits, (job->jc != NULL) ? job->jc : willem_find_jumpers(cc->jumpers));
+    }
+    else if (!s->powered && job->jc != NULL)
+    {
+        set_address_width(s, job->jc->addr_bits, job->jc);
+    }
+
+    if (size == 0 && cc != NULL)
+    {
+        size = cc->size;
+    }
+
+    if ((job->do_read || job->do_crc || job->do_blank_check) && size == 0)
+    {
+        fail(s, "Need to provide memory size\n");
+        return -1;
+    }
+
+    e->cc = (cc != NULL) ? cc : &eprom_default;
+
+    start = pp_time(&s->pp);
+
+    for (int i = 0; i < ESTIMATE_PROBE_OPS; i++)
+    {
+        pp_rstatus(&s->pp);
+    }
+
+    e->op_ns = (double) (pp_time(&s->pp) - start) / ESTIMATE_PROBE_OPS;
+
+    eb.op_ns = e->op_ns;
+    eb.timing = &s->bus.timing;
+    eb.shift_ops = 2 * s->bus.addr_width;
+    wave_read(&w);
+    eb.read_ops = w.len;
+
+    for (unsigned int i = 0; i < w.len; i++)
+    {
+        eb.read_samples += (w.ops[i] & PP_OP_SAMPLE) != 0;
+    }
+
+    /* Power up and identification */
+    estimate_ops(&eb, &e->phase[WILLEM_PHASE_ID], 1, POWER_ON_USEC * 1000ULL);
+
+    if (job->flash && job->chip == NULL)
+    {
+        estimate_writes(&eb, &e->phase[WILLEM_PHASE_ID], 6, 6);
+        estimate_reads(&eb, &e->phase[WILLEM_PHASE_ID], 2, true);
+        estimate_ops(&eb, &e->phase[WILLEM_PHASE_ID], 0, 20000000ULL);
+    }
+
+    if (job->flash && job->do_erase)
+    {
+        struct willem_phase_stats *st = &e->phase[WILLEM_PHASE_ERASE];
+        uint64_t erase_ns = 0;
+
+        if (cc->sectors != NULL)
+        {
+            for (const struct erase_region *r = cc->sectors; r->size != 0; r++)
+            {
+                erase_ns += r->count * cc->typ_sector_erase_msec * 1000000ULL;
+            }
+        }
+        else if (cc->max_chip_erase_sec != (unsigned int) -1)
+        {
+            /* No typical time known, the limit will do */
+            erase_ns = cc->max_chip_erase_sec * 1000000000ULL;
+        }
+
+        estimate_writes(&eb, st, 6, 6);
+        estimate_wait(&eb, st, erase_ns, ERASE_POLL_USEC);
+    }
+
+    if (job->eprom && job->do_erase)
+    {
+        estimate_ops(&eb, &e->phase[WILLEM_PHASE_ERASE], eb.shift_ops + 6, 100000000ULL);
+    }
+
+    if (job->do_blank_check || job->do_read || job->do_crc)
+    {
+        struct willem_phase_stats *st = &e->phase[(job->do_read || job->do_crc) ? WILLEM_PHASE_READ : WILLEM_PHASE_BLANK_CHECK];
+
+        estimate_reads(&eb, st, size, true);
+        st->bytes += size;
+    }
+
+    if (job->do_write != NULL)
+    {
+        struct willem_phase_stats *wr = &e->phase[WILLEM_PHASE_WRITE];
+        struct willem_phase_stats *ver = &e->phase[WILLEM_PHASE_VERIFY];
+        uint32_t unit_end = 0;
+
+        if (job->incremental && !job->eprom)
+        {
+            uint32_t first = 0, last = 0, len;
+
+            flash_sector(cc, job->offset, &first);
+            len = flash_sector(cc, job->offset + job->image_len - 1, &last);
+
+            estimate_reads(&eb, &e->phase[WILLEM_PHASE_READ], last + len - first, true);
+            e->phase[WILLEM_PHASE_READ].bytes += last + len - first;
+        }
+
+        for (uint32_t addr = 0; addr < job->image_len; addr += BLOCK_SIZE)
+        {
+            const uint8_t *data = job->image + addr;
+            uint32_t len = (job->image_len - addr < BLOCK_SIZE) ? job->image_len - addr : BLOCK_SIZE;
+
+            if (job->eprom)
+            {
+                estimate_eprom_block(&eb, wr, e->cc, data, len);
+            }
+            else
+            {
+                estimate_flash_block(&eb, wr, cc, job->offset + addr, data, len);
+            }
+
+            wr->bytes += len;
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                uint32_t chip_addr = job->offset + addr + i;
+
+                if (data[i] == 0xff)
+                {
+                    continue;
+                }
+
+                e->write_bytes++;
+
+                /* Pages, sectors or, for neither, write blocks */
+                if (chip_addr >= unit_end)
+                {
+                    uint32_t unit_start = chip_addr;
+                    uint32_t unit_len = (cc != NULL && !job->eprom) ? flash_sector(cc, chip_addr, &unit_start) : 0;
+
+                    if (unit_len == 0)
+                    {
+                        unit_start = chip_addr - chip_addr % BLOCK_SIZE;
+                        unit_len = BLOCK_SIZE;
+                    }
+
+                    unit_end = unit_start + unit_len;
+                    e->write_units++;
+                }
+            }
+
+            if (job->do_verify)
+            {
+                estimate_reads(&eb, ver, len, true);
+                ver->bytes += len;
+
+                /* EPROM outputs need VPP off */
+                if (job->eprom)
+                {
+                    estimate_ops(&eb, ver, 2, 2 * VPP_SETTLE_USEC * 1000ULL);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < WILLEM_PHASES; i++)
+    {
+        e->phase[i].delay_actual_ns = e->phase[i].delay_requested_ns;
+    }
+
+    return 0;
+}
+
+/* Sums up the counters of all phases */
+void willem_phase_totals(const struct willem_session *s, struct willem_phase_stats *total)
+{
+    memset(total, 0, sizeof(*total));
+
+    for (int i = 0; i < WILLEM_PHASES; i++)
+    {
+        const struct willem_phase_stats *st = &s->phase_stats[i];
+
+        total->time_ns += st->time_ns;
+        total->bytes += st->bytes;
+        total->port_ops += st->port_ops;
+        total->addr_shifts += st->addr_shifts;
+        total->status_polls += st->status_polls;
+        total->delay_requested_ns += st->delay_requested_ns;
+        total->delay_actual_ns += st->delay_actual_ns;
+    }
+}
+
+/*
+ * Runs the selected operations on a single board. Returns 0 on success, -1
+ * on failure.
+ */
+int willem_run(struct willem_session *s)
+{
+    const struct willem_job *job = s->job;
+    int res = -1;
+
+    if (willem_open(s) == -1)
+    {
+        return -1;
+    }
+
+    if (job->do_test != -1)
+    {
+        switch (job->do_test)
+        {
+        case 1: // vcc on
+            pp_wdata(&s->pp, 0);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_INIT);
+            break;
+        case 3: // vpp on
+            pp_wdata(&s->pp, 0);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_STROBE);
+            break;
+        case 6: // s4 low
+            pp_wdata(&s->pp, 0);
+            pp_wcontrol(&s->pp, 0);
+            break;
+        case 8: // s6 low
+            pp_wdata(&s->pp, 0);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_AUTOFD);
+            break;
+        case 9: // d high
+            pp_wdata(&s->pp, 2);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT);
+            break;
+        case 11:    // clk high
+            pp_wdata(&s->pp, 1);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT);
+            break;
+        default:
+            pp_wdata(&s->pp, 0);
+            pp_wcontrol(&s->pp, PARPORT_CONTROL_SELECT);
+            break;
+        }
+
+        /* Lines are left as set for measurement, closing the port keeps them */
+        res = 0;
+        goto close;
+    }
+
+    willem_reset(s);
+
+    if (willem_power_on(s) == -1)
+    {
+        goto close;
+    }
+
+    if (willem_run_job(s, job) == -1)
+    {
+        set_vcc(s, false);
+        goto close;
+    }
+
+    willem_power_off(s);
+    res = 0;
+
+close:
+    willem_close(s);
+
+    return res;
+}
+
+void willem_close(struct willem_session *s)
+{
+    stats_enter(s, WILLEM_PHASE_IDLE);
+
+    if (pp_trace_close(&s->pp) == -1)
+    {
+        info(s, "Writing trace %s failed: %s\n", s->trace, strerror(errno));
+    }
+
+    pp_close(&s->pp);
+}
+
+/* Stops the running operation, safe to call from a signal handler */
+void willem_cancel(struct willem_session *s)
+{
+    s->terminate = true;
+}
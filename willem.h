@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2022-2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WILLEM_H
+#define WILLEM_H
+
+#include "pp.h"
+#include "bus.h"
+#include "rt.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TBLC_LOAD_USEC 150              /* AT29C maximum gap between byte loads */
+
+struct erase_region
+{
+    uint32_t size;
+    unsigned int count;
+};
+
+struct chip_config
+{
+    uint16_t id;                        /* Chip id (manufacturer and device) */
+    uint32_t size;                      /* Size in bytes */
+    uint32_t sector_size;               /* Sector size or 0 if byte-programmed */
+    const char *name;                   /* Chip name */
+    unsigned int max_write_usec;        /* Maximum sector/byte write time in microseconds */
+    unsigned int max_chip_erase_sec;    /* Maximum chip erase time in seconds */
+    int addr_bits;                      /* Number of address lines */
+    const char *jumpers;                /* J3 layout, see README */
+    unsigned int flags;
+    unsigned int pulse_usec;            /* EPROM program pulse width */
+    unsigned int max_pulses;            /* EPROM program pulses before giving up */
+    unsigned int overprogram;           /* EPROM overprogram pulse in multiples of pulses needed */
+    const struct erase_region *sectors; /* Erase sectors or NULL if only chip erase is supported */
+    unsigned int max_sector_erase_sec;  /* Maximum sector erase time in seconds */
+    unsigned int typ_write_usec;        /* Typical sector/byte write time, for estimates */
+    unsigned int typ_sector_erase_msec; /* Typical sector erase time, for estimates */
+};
+
+#define CHIP_DQ5 1                      /* DQ5 signals exceeded timing limits */
+#define CHIP_EPROM 2                    /* EPROM, selected with --chip */
+#define CHIP_UNLOCK_BYPASS 4            /* Two-cycle programming after unlock bypass */
+
+/*
+ * J3 layouts from README. The socket is wired for the largest chip of a
+ * pin-compatible family, so on smaller parts some of the upper address bits
+ * land on control pins (2716 VPP, 2764/27128 /PGM, 27C010/27C020 /PGM) and
+ * have to be shifted out at their inactive level.
+ */
+struct jumper_config
+{
+    const char *name;                   /* Layout name */
+    int addr_bits;                      /* Number of address lines */
+    uint32_t hold_mask;                 /* Shift register bits driving control pins */
+    uint32_t hold_value;                /* Inactive level of these pins */
+};
+
+/*
+ * Hooks called while a job runs, all optional except read_chunk for reads.
+ * They run in the thread driving the session.
+ */
+struct willem_callbacks
+{
+    /* Progress of a phase, kb is -1 if it has no byte count. Nonzero cancels. */
+    int (*progress)(void *arg, const char *phase, long kb);
+
+    /* Informational message, one line */
+    void (*message)(void *arg, const char *text);
+
+    /* Error message, also kept in the session */
+    void (*error)(void *arg, const char *text);
+
+    /* Data read from the chip at addr. Returns 0 or -1 with errno set. */
+    int (*read_chunk)(void *arg, uint32_t addr, const uint8_t *data, size_t len);
+
+    /* First done bytes of the image are written, and verified if asked to */
+    void (*written)(void *arg, uint32_t done);
+
+    /* Chip identified or selected, cc and chip_id are set. May change bus.timing. */
+    void (*identified)(void *arg);
+
+    void *arg;
+};
+
+/* Operations to run, the same job may be shared by several sessions */
+struct willem_job
+{
+    bool eprom;
+    bool flash;
+    bool do_erase;
+    bool do_blank_check;
+    bool do_read;
+    const char *do_write;               /* Name of the image, for messages */
+    bool do_verify;
+    bool do_crc;
+    bool incremental;
+    int do_test;
+    bool paranoid;
+    uint32_t size;
+    uint32_t offset;
+    uint32_t resume;                    /* Bytes done by an interrupted run, a resumed write doesn't erase */
+    const char *chip;
+    const struct jumper_config *jc;
+
+    /* Image to write, read only, owned by the caller */
+    const uint8_t *image;
+    uint32_t image_len;
+};
+
+/* Phases statistics are kept for */
+enum willem_phase
+{
+    WILLEM_PHASE_IDLE = 0,              /* Between phases, e.g. power up and down */
+    WILLEM_PHASE_ID,
+    WILLEM_PHASE_ERASE,
+    WILLEM_PHASE_BLANK_CHECK,
+    WILLEM_PHASE_READ,                  /* Also checksums and the read of an incremental write */
+    WILLEM_PHASE_WRITE,
+    WILLEM_PHASE_VERIFY,                /* Also verification right after writing a block */
+    WILLEM_PHASES
+};
+
+extern const char *willem_phase_names[WILLEM_PHASES];
+
+/* Slow bus timing calibration starts from */
+extern const struct bus_timing willem_calibrate_start;
+
+/* Counters of a phase, times are simulated for PP_SIM */
+struct willem_phase_stats
+{
+    uint64_t time_ns;
+    uint64_t bytes;
+    unsigned long port_ops;
+    unsigned long addr_shifts;
+    unsigned long status_polls;
+    uint64_t delay_requested_ns;
+    uint64_t delay_actual_ns;
+};
+
+/* Expected counters of a job, see willem_estimate() */
+struct willem_estimate
+{
+    const struct chip_config *cc;       /* Chip the estimate is for */
+    double op_ns;                       /* Measured time of a single port access */
+    uint32_t write_bytes;               /* Bytes to program, 0xff is skipped */
+    uint32_t write_units;               /* Sectors, AT29C pages or 1 kB blocks holding such bytes */
+    struct willem_phase_stats phase[WILLEM_PHASES];
+};
+
+#define WILLEM_HISTOGRAM_BUCKETS 24
+
+/* Program times of erase sectors, AT29C pages or, for EPROMs, 1 kB blocks */
+struct willem_histogram
+{
+    uint32_t unit;                      /* Bytes per sample */
+    unsigned long count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    unsigned long buckets[WILLEM_HISTOGRAM_BUCKETS];    /* Bucket i counts times below 2^i us */
+};
+
+/* State of a single board */
+struct willem_session
+{
+    const char *port;
+    const struct willem_job *job;
+    struct willem_callbacks cb;
+    const char *trace;                  /* File to record port operations to or NULL */
+    const struct bus_timing *timing;    /* Bus timing until the chip is identified, NULL for default */
+    pp_t pp;
+
+    /* Chip access paths and address shift register state */
+    bus_t bus;
+
+    volatile bool terminate;
+
+    /* Current phase, may be polled from another thread */
+    const char *phase;
+    volatile uint32_t progress_kb;
+
+    /* Last error */
+    char error[160];
+
+    /* Chip powered up and identified, kept between jobs */
+    bool powered;
+    const struct chip_config *cc;
+    uint16_t chip_id;
+
+    /* Result of the last checksum */
+    uint32_t crc;
+
+    unsigned long status_polls;
+
+    unsigned long eprom_bytes;
+    unsigned long eprom_pulses;
+
+    unsigned long pages_retried;
+
+    /* Timing critical sections: programming pulses and page loads */
+    struct rt_stats rt_stats;
+
+    /* Counters per phase, the current phase runs since stats_mark */
+    enum willem_phase stats_phase;
+    struct willem_phase_stats stats_mark;
+    struct willem_phase_stats phase_stats[WILLEM_PHASES];
+
+    /* Program time of the sector being written and the finished ones */
+    uint32_t program_sector;
+    uint64_t program_ns;
+    struct willem_histogram program_hist;
+};
+
+struct jumper_config *willem_find_jumpers(const char *name);
+
+void willem_init(struct willem_session *s, const char *port, const struct willem_job *job, const struct willem_callbacks *cb);
+int willem_open(struct willem_session *s);
+void willem_reset(struct willem_session *s);
+int willem_power_on(struct willem_session *s);
+void willem_power_off(struct willem_session *s);
+int willem_run_job(struct willem_session *s, const struct willem_job *job);
+int willem_verify(struct willem_session *s, uint32_t offset, const uint8_t *data, uint32_t len);
+int willem_run(struct willem_session *s);
+void willem_close(struct willem_session *s);
+int willem_calibrate(struct willem_session *s, bool write_test, struct bus_timing *result);
+int willem_estimate(struct willem_session *s, struct willem_estimate *e);
+void willem_phase_totals(const struct willem_session *s, struct willem_phase_stats *total);
+void willem_cancel(struct willem_session *s);
+
+#endif /* WILLEM_H */
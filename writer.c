@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2024 Wojtek Kaniewski <wojtekka@toxygen.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Background file writer. Data is collected in fixed-size chunks which are
+ * written by a separate thread, so a slow disk does not stall the caller.
+ * At most the given number of chunks is held in memory, the caller waits
+ * for a free one when all of them are queued.
+ */
+
+#define _GNU_SOURCE
+
+#include "writer.h"
+#include "rt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+struct chunk
+{
+    uint8_t *data;
+    off_t pos;                          /* File position of the first byte */
+    size_t len;                         /* Bytes collected */
+};
+
+struct writer
+{
+    int fd;
+    size_t chunk_size;
+    unsigned int count;
+    struct chunk *chunks;
+
+    /* Chunks are filled and written in ring order */
+    unsigned int fill;                  /* Chunk being filled by the caller */
+    unsigned int queued;                /* Chunks waiting for the thread */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool closing;
+    int error;                          /* errno of the first failed write */
+};
+
+/*
+ * Drops the real-time policy and CPU pinning inherited from the thread
+ * driving the board, so blocking file I/O doesn't compete with it.
+ */
+static void writer_thread_setup(void)
+{
+    struct sched_param sp = { 0 };
+    cpu_set_t set;
+
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+
+    CPU_ZERO(&set);
+
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        CPU_SET(i, &set);
+    }
+
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *writer_thread(void *arg)
+{
+    struct writer *w = arg;
+
+    writer_thread_setup();
+
+    pthread_mutex_lock(&w->lock);
+
+    while (true)
+    {
+        while (w->queued == 0 && !w->closing)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        if (w->queued == 0)
+        {
+            break;
+        }
+
+        struct chunk *c = &w->chunks[(w->fill + w->count - w->queued) % w->count];
+
+        pthread_mutex_unlock(&w->lock);
+
+        size_t done = 0;
+        int error = 0;
+
+        while (done < c->len)
+        {
+            ssize_t res = pwrite(w->fd, c->data + done, c->len - done, c->pos + done);
+
+            if (res == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                error = errno;
+                break;
+            }
+
+            done += res;
+        }
+
+        pthread_mutex_lock(&w->lock);
+
+        if (error != 0 && w->error == 0)
+        {
+            w->error = error;
+        }
+
+        c->len = 0;
+        w->queued--;
+        pthread_cond_broadcast(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/* Hands the chunk being filled over to the thread */
+static void queue_chunk(struct writer *w)
+{
+    pthread_mutex_lock(&w->lock);
+
+    w->queued++;
+    w->fill = (w->fill + 1) % w->count;
+    pthread_cond_broadcast(&w->cond);
+
+    /* The next chunk to fill may still be waiting to be written */
+    while (w->queued == w->count)
+    {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Starts a writer for the file. Returns NULL on failure with errno set.
+ */
+struct writer *writer_open(int fd, size_t chunk_size, unsigned int chunks)
+{
+    struct writer *w = calloc(1, sizeof(*w));
+
+    if (w == NULL)
+    {
+        return NULL;
+    }
+
+    w->fd = fd;
+    w->chunk_size = chunk_size;
+    w->count = chunks;
+    w->chunks = calloc(chunks, sizeof(w->chunks[0]));
+
+    if (w->chunks == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < chunks; i++)
+    {
+        w->chunks[i].data = malloc(chunk_size);
+
+        if (w->chunks[i].data == NULL)
+        {
+            while (i-- > 0)
+            {
+                free(w->chunks[i].data);
+            }
+            free(w->chunks);
+            free(w);
+            return NULL;
+        }
+
+        /* Filled from the read loop, which shouldn't take page faults */
+        rt_prefault(w->chunks[i].data, chunk_size);
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    int res = pthread_create(&w->thread, NULL, writer_thread, w);
+
+    if (res != 0)
+    {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+
+        for (unsigned int i = 0; i < chunks; i++)
+        {
+            free(w->chunks[i].data);
+        }
+        free(w->chunks);
+        free(w);
+        errno = res;
+        return NULL;
+    }
+
+    return w;
+}
+
+/*
+ * Queues len bytes to be written at pos. Returns 0 on success or -1 with
+ * errno set if an earlier write has failed.
+ */
+int writer_write(struct writer *w, off_t pos, const uint8_t *data, size_t len)
+{
+    pthread_mutex_lock(&w->lock);
+    int error = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+
+    while (len > 0)
+    {
+        struct chunk *c = &w->chunks[w->fill];
+
+        /* Data not following the collected bytes starts a new chunk */
+        if (c->len > 0 && c->pos + c->len != pos)
+        {
+            queue_chunk(w);
+            continue;
+        }
+
+        if (c->len == 0)
+        {
+            c->pos = pos;
+        }
+
+        size_t n = w->chunk_size - c->len;
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy(c->data + c->len, data, n);
+
+        c->len += n;
+        pos += n;
+        data += n;
+        len -= n;
+
+        if (c->len == w->chunk_size)
+        {
+            queue_chunk(w);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the remaining data and stops the thread. Returns 0 if everything
+ * was written, -1 with errno set otherwise.
+ */
+int writer_close(struct writer *w)
+{
+    if (w->chunks[w->fill].len > 0)
+    {
+        queue_chunk(w);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->closing = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    int error = w->error;
+
+    for (unsigned int i = 0; i < w->count; i++)
+    {
+        free(w->chunks[i].data);
+    }
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->chunks);
+    free(w);
+
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}